@@ -0,0 +1,210 @@
+#ifndef __IP_CHECKSUM_H__
+#define __IP_CHECKSUM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+/*
+  IPv4 头部的 Internet checksum（RFC 1071），只有头文件，HAL 和各个实验共用。
+  反码和与字节序无关（RFC 1071 2(B)）：按主机字节序每次读 4 字节累加到 64 位整数，
+  最后折叠成 16 位，结果按主机字节序原样写回报文即可，不需要逐字节移位拼接。
+  转发时 TTL 减一，校验和按 RFC 1624 增量更新，不再重新计算整个头部；
+  检查校验和、检查 TTL 和更新只需要读一遍头部。
+  ipClassify() 一次检查收到的包的各个字段，给出处理路径或者丢弃的原因。
+*/
+
+// ipForwardHeader() 的结果
+#define IP_FORWARD_OK 0
+#define IP_FORWARD_BAD_CHECKSUM 1
+#define IP_FORWARD_TTL_EXCEEDED 2
+
+// ipClassify() 的结果：前三种是处理路径，从 IP_CLASS_DROP 开始是丢弃的原因，
+// 一个包有多个问题时取编号最小的原因
+#define IP_CLASS_FORWARD 0 // 不带选项，转发
+#define IP_CLASS_LOCAL 1 // 不带选项，发给路由器自己
+#define IP_CLASS_SLOW 2 // 带选项，走慢速路径
+#define IP_CLASS_DROP 3
+#define IP_CLASS_DROP_TRUNCATED 3 // 不足 20 字节，或者总长度超过收到的长度
+#define IP_CLASS_DROP_VERSION 4 // 版本不是 4
+#define IP_CLASS_DROP_HEADER_LENGTH 5 // IHL 小于 5 ，或者总长度小于头部长度
+#define IP_CLASS_DROP_CHECKSUM 6 // 头部校验和错误
+#define IP_CLASS_DROP_SOURCE 7 // 源地址是 127/8 、组播或广播，转发时还包括 0/8
+#define IP_CLASS_DROP_DESTINATION 8 // 转发时目的地址是 0/8 、127/8 、组播或 E 类地址
+#define IP_CLASS_DROP_FRAGMENT 9 // 发给路由器自己的分片，不做重组
+#define IP_CLASS_DROP_TTL 10 // 转发时 TTL 减一后为零
+#define IP_CLASS_COUNT 11
+
+/**
+ * @brief 把一段数据按 16 位字累加到反码和中，还没有折叠
+ * @param data 数据，不需要对齐
+ * @param len 数据的长度，单位是字节，奇数长度的最后一个字节补零
+ * @param sum 之前的累加结果
+ * @return 新的累加结果，交给 ipChecksumFold() 折叠
+ */
+static inline uint64_t ipChecksumAdd(const uint8_t *data, size_t len, uint64_t sum) {
+  for (; len >= 4; data += 4, len -= 4) {
+    uint32_t word;
+    memcpy(&word, data, sizeof(word));
+    sum += word;
+  }
+  if (len >= 2) {
+    uint16_t word;
+    memcpy(&word, data, sizeof(word));
+    sum += word;
+    data += 2;
+    len -= 2;
+  }
+  if (len) {
+    uint8_t last[2] = {data[0], 0};
+    uint16_t word;
+    memcpy(&word, last, sizeof(word));
+    sum += word;
+  }
+  return sum;
+}
+
+// folds the 64-bit sum into 16 bits with end-around carries
+static inline uint16_t ipChecksumFold(uint64_t sum) {
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (uint16_t)sum;
+}
+
+// length of the IP header in bytes, 0 if it is shorter than 20 bytes or longer than len
+static inline size_t ipHeaderLength(const uint8_t *header, size_t len) {
+  size_t ihl = 4 * (size_t)(header[0] & 0xf);
+  return ihl < 20 || ihl > len ? 0 : ihl;
+}
+
+/**
+ * @brief UDP 伪首部（RFC 768）的反码和，还没有折叠
+ * @param src_addr 源 IP 地址，大端序
+ * @param dst_addr 目的 IP 地址，大端序
+ * @param protocol 协议号
+ * @param len UDP 头和载荷的长度，单位是字节
+ * @return 累加结果，作为载荷求和时的初始值
+ */
+static inline uint64_t ipPseudoHeaderSum(uint32_t src_addr, uint32_t dst_addr, uint8_t protocol, uint16_t len) {
+  // zero, protocol and length as they appear on the wire
+  uint8_t rest[4] = {0, protocol, (uint8_t)(len >> 8), (uint8_t)len};
+  return ipChecksumAdd(rest, sizeof(rest), (uint64_t)src_addr + dst_addr);
+}
+
+/**
+ * @brief 检查 IP 头的校验和
+ * @param header 完整的 IP 头
+ * @param len header 中可用的字节数
+ * @return 头部完整且校验和无误时返回 true
+ */
+static inline bool ipChecksumValid(const uint8_t *header, size_t len) {
+  size_t ihl = ipHeaderLength(header, len);
+  // every word including the checksum sums to 0xffff
+  return ihl && ipChecksumFold(ipChecksumAdd(header, ihl, 0)) == 0xffff;
+}
+
+/**
+ * @brief 计算并填写 IP 头的校验和，IHL 必须已经填好
+ * @param header IP 头，原地修改
+ */
+static inline void ipChecksumFill(uint8_t *header) {
+  memset(header + 10, 0, 2);
+  uint16_t checksum = (uint16_t)~ipChecksumFold(ipChecksumAdd(header, 4 * (size_t)(header[0] & 0xf), 0));
+  memcpy(header + 10, &checksum, sizeof(checksum));
+}
+
+/**
+ * @brief 把校验和已经检查过的 IP 头的 TTL 减一，校验和按 RFC 1624 增量更新
+ * @param header IP 头，原地修改
+ * @return TTL 减一后为零时返回 false ，头部不变
+ */
+static inline bool ipDecrementTtl(uint8_t *header) {
+  if (header[8] <= 1) {
+    return false;
+  }
+  // RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m'), m is the TTL and protocol word,
+  // here in network order; m' = m - 0x100 so ~m + m' is always 0xfeff
+  uint32_t checksum = (uint32_t)header[10] << 8 | header[11];
+  uint32_t sum = (~checksum & 0xffff) + 0xfeff;
+  sum = (sum & 0xffff) + (sum >> 16);
+  checksum = ~sum & 0xffff;
+  header[8]--;
+  header[10] = (uint8_t)(checksum >> 8);
+  header[11] = (uint8_t)checksum;
+  return true;
+}
+
+/**
+ * @brief 判断目的地址是不是路由器自己
+ * @param dst_addr 目的 IP 地址，大端序
+ * @param local_addrs 路由器各个端口的地址，大端序
+ * @param n_local local_addrs 的个数
+ * @return 目的地址是某个端口的地址、 224.0.0.0/24 或 255.255.255.255 时返回 true
+ */
+static inline bool ipLocalDestination(uint32_t dst_addr, const uint32_t *local_addrs, size_t n_local) {
+  uint8_t dst[4];
+  memcpy(dst, &dst_addr, sizeof(dst));
+  // neither link-local multicast (RFC 5771) nor limited broadcast (RFC 1812 5.3.5.1) is forwarded
+  bool local = ((dst[0] == 224) & (dst[1] == 0) & (dst[2] == 0)) | (dst_addr == 0xffffffff);
+  for (size_t i = 0; i < n_local; i++) {
+    local |= dst_addr == local_addrs[i];
+  }
+  return local;
+}
+
+/**
+ * @brief 一次读完 IP 头的各个字段，决定这个包的处理路径或者丢弃的原因
+ * @param header IP 头，至少可以读 20 字节，即使 len 更小
+ * @param len 收到的字节数
+ * @param checksum_ok 头部校验和是否无误，例如 validateIPChecksumBatch() 位图中对应的位为 0
+ * @param local_addrs 路由器各个端口的地址，大端序
+ * @param n_local local_addrs 的个数
+ * @return IP_CLASS_* 之一
+ *
+ * 每项检查都算出来再合并成位掩码，没有依赖于包内容的分支，畸形的包不会打乱分支预测。
+ */
+static inline uint8_t ipClassify(const uint8_t *header, size_t len, bool checksum_ok, const uint32_t *local_addrs,
+                                 size_t n_local) {
+  size_t ihl = 4 * (size_t)(header[0] & 0xf);
+  size_t total = (size_t)header[2] << 8 | header[3];
+  uint32_t src_addr, dst_addr;
+  memcpy(&src_addr, header + 12, sizeof(src_addr));
+  memcpy(&dst_addr, header + 16, sizeof(dst_addr));
+  uint32_t local = ipLocalDestination(dst_addr, local_addrs, n_local);
+  uint32_t src = header[12], dst = header[16];
+  // bit k stands for reason IP_CLASS_DROP + k
+  uint32_t reasons = (uint32_t)((len < 20) | (total > len));
+  reasons |= (uint32_t)(header[0] >> 4 != 4) << 1;
+  reasons |= (uint32_t)((ihl < 20) | (total < ihl)) << 2;
+  reasons |= (uint32_t)!checksum_ok << 3;
+  // martian addresses, RFC 1812 5.3.7; 0.0.0.0 may still talk to the router itself
+  reasons |= (uint32_t)((src == 127) | (src >= 224) | ((src == 0) & !local)) << 4;
+  reasons |= (uint32_t)(((dst == 0) | (dst == 127) | (dst >= 224)) & !local) << 5;
+  // more fragments or a fragment offset
+  reasons |= (uint32_t)((((header[6] & 0x3f) | header[7]) != 0) & local) << 6;
+  reasons |= (uint32_t)((header[8] <= 1) & !local) << 7;
+  uint32_t fate = ihl > 20 ? IP_CLASS_SLOW : local ? IP_CLASS_LOCAL : IP_CLASS_FORWARD;
+  uint32_t verdict = IP_CLASS_DROP + __builtin_ctz(reasons | 1u << (IP_CLASS_COUNT - IP_CLASS_DROP));
+  return (uint8_t)(verdict < IP_CLASS_COUNT ? verdict : fate);
+}
+
+/**
+ * @brief 转发时检查 IP 头并把 TTL 减一，校验和按 RFC 1624 增量更新
+ * @param header IP 头，原地修改
+ * @param len header 中可用的字节数
+ * @return IP_FORWARD_OK ；校验和错误或头部不完整时返回 IP_FORWARD_BAD_CHECKSUM ，
+ *         TTL 减一后为零时返回 IP_FORWARD_TTL_EXCEEDED ，这两种情况下头部不变
+ */
+static inline int ipForwardHeader(uint8_t *header, size_t len) {
+  if (!ipChecksumValid(header, len)) {
+    return IP_FORWARD_BAD_CHECKSUM;
+  }
+  return ipDecrementTtl(header) ? IP_FORWARD_OK : IP_FORWARD_TTL_EXCEEDED;
+}
+
+#endif
@@ -17,6 +17,16 @@ typedef uint32_t in_addr_t;
 #define N_IFACE_ON_BOARD 4
 typedef uint8_t macaddr_t[6];
 
+// HAL_ReceiveIPPacketBurst 的一个报文，缓冲区由调用者提供
+typedef struct {
+  uint8_t *buffer;   // IN，接收缓冲区
+  size_t length;     // IN，接收缓冲区大小
+  int ip_length;     // OUT，报文的实际长度，可能大于 length ，此时只复制了前 length 字节
+  int if_index;      // OUT，报文来源的接口号
+  macaddr_t src_mac; // OUT，IPv4 报文下层的源 MAC 地址
+  macaddr_t dst_mac; // OUT，IPv4 报文下层的目的 MAC 地址
+} HAL_IPPacket;
+
 enum HAL_ERROR_NUMBER {
   HAL_ERR_INVALID_PARAMETER = -1000,
   HAL_ERR_IP_NOT_EXIST,
@@ -84,7 +94,8 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac);
  * @param length IN，接收缓存区大小
  * @param src_mac OUT，IPv4 报文下层的源 MAC 地址
  * @param dst_mac OUT，IPv4 报文下层的目的 MAC 地址
- * @param timeout IN，设置接收超时时间（毫秒），-1 表示无限等待
+ * @param timeout IN，设置接收超时时间（毫秒），-1 表示无限等待，0
+ * 表示不等待，只把每个接口检查一遍
  * @param if_index OUT，实际接收到的报文来源的接口号，不能为空指针
  * @return int >0 表示实际接收的报文长度，=0 表示超时返回，<0 表示发生错误
  */
@@ -92,6 +103,21 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
                         macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
                         int *if_index);
 
+/**
+ * @brief 一次接收多个 IPv4 报文，参数检查和等待只做一次，之后把已经到达的报文
+ * 依次取出，不再等待；其余约定与 HAL_ReceiveIPPacket 相同
+ *
+ * @param if_index_mask IN，接口索引号的 bitset，同 HAL_ReceiveIPPacket
+ * @param packets IN/OUT，count 个报文描述符，调用者填好 buffer 和 length
+ * @param count IN，最多接收的报文数，大于 0
+ * @param timeout IN，等待第一个报文的超时时间（毫秒），-1 表示无限等待，0
+ * 表示不等待
+ * @return int >0 表示实际接收的报文数，结果在 packets 的前若干项，=0 表示超时返回，
+ * <0 表示发生错误；已经收到报文时先返回这些报文，错误在下一次调用时返回
+ */
+int HAL_ReceiveIPPacketBurst(int if_index_mask, HAL_IPPacket *packets,
+                             int count, int64_t timeout);
+
 /**
  * @brief 发送一个 IP 报文，它的源 MAC 地址就是对应接口的 MAC 地址
  *
@@ -2,6 +2,7 @@
 #define __ROUTER_HAL_COMMON_H__
 
 // don't include this file in your own code.
+#include "ip_checksum.h"
 #include "router_hal.h"
 #include <string.h>
 
@@ -23,16 +24,7 @@ void HAL_JoinIGMPGroup(int if_index, in_addr_t ip) {
       0xe0, 0x00, 0x00, 0x09  // RIP Multicast
   };
   memcpy(&buffer[12], &ip, sizeof(in_addr_t));
-  uint32_t ip_chksum = 0;
-  for (int i = 0; i < 12; i++) {
-    ip_chksum += ((uint16_t *)buffer)[i];
-  }
-  while (ip_chksum >= 0x10000) {
-    ip_chksum -= 0x10000;
-    ip_chksum += 1;
-  }
-  uint16_t chksum = ~ip_chksum;
-  memcpy(&buffer[10], &chksum, sizeof(uint16_t));
+  ipChecksumFill(buffer);
   macaddr_t dst_mac = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x16};
   HAL_SendIPPacket(if_index, buffer, sizeof(buffer), dst_mac);
 }
@@ -35,6 +35,87 @@ pcap_t *pcap_out_handles[N_IFACE_ON_BOARD];
 std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
 std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
 
+// reads one frame from the capture handle of port, ARP is handled here; returns the
+// length of an IPv4 packet, 0 when the port has nothing for us, -1 when a frame
+// was consumed and the port should be polled again
+static int receiveFrame(int port, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac) {
+  struct pcap_pkthdr hdr;
+  const uint8_t *packet = pcap_next(pcap_in_handles[port], &hdr);
+  if (packet && hdr.caplen >= IP_OFFSET &&
+      memcmp(&packet[6], interface_mac[port], sizeof(macaddr_t)) == 0) {
+    // skip outbound
+    return -1;
+  } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
+             packet[13] == 0x00) {
+    // IPv4
+    // TODO: what if len != caplen
+    // Beware: might be larger than MTU because of offloading
+    size_t ip_len = hdr.caplen - IP_OFFSET;
+    size_t real_length = length > ip_len ? ip_len : length;
+    memcpy(buffer, &packet[IP_OFFSET], real_length);
+    memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
+    memcpy(src_mac, &packet[6], sizeof(macaddr_t));
+    return ip_len;
+  } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
+             packet[13] == 0x06) {
+    // ARP
+    // learn it
+    macaddr_t mac;
+    memcpy(mac, &packet[22], sizeof(macaddr_t));
+    in_addr_t ip;
+    memcpy(&ip, &packet[28], sizeof(in_addr_t));
+    memcpy(arp_table[std::pair<in_addr_t, int>(ip, port)], mac,
+           sizeof(macaddr_t));
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+
+    in_addr_t dst_ip;
+    memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+    // ask me: reply
+    if (dst_ip == interface_addrs[port] && packet[21] == 0x01) {
+      // reply
+      uint8_t buffer[64] = {0};
+      // dst mac
+      memcpy(buffer, &packet[6], sizeof(macaddr_t));
+      // src mac
+      macaddr_t mac;
+      HAL_GetInterfaceMacAddress(port, mac);
+      memcpy(&buffer[6], mac, sizeof(macaddr_t));
+      // ARP
+      buffer[12] = 0x08;
+      buffer[13] = 0x06;
+      // hardware type
+      buffer[15] = 0x01;
+      // protocol type
+      buffer[16] = 0x08;
+      // hardware size
+      buffer[18] = 0x06;
+      // protocol size
+      buffer[19] = 0x04;
+      // opcode
+      buffer[21] = 0x02;
+      // sender
+      memcpy(&buffer[22], mac, sizeof(macaddr_t));
+      memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
+      // target
+      memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
+      memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
+
+      pcap_inject(pcap_out_handles[port], buffer, sizeof(buffer));
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+                inet_ntoa(in_addr{ip}));
+      }
+    }
+    // otherwise: learn and ignore
+    return -1;
+  }
+  return 0;
+}
+
 extern "C" {
 int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   if (inited) {
@@ -225,95 +306,95 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   int64_t current_time = 0;
   // Round robin
   int current_port = 0;
-  struct pcap_pkthdr hdr;
+  // with timeout 0, every interface is polled once
+  int polled = 0;
   do {
     if ((if_index_mask & (1 << current_port)) == 0 ||
         !pcap_in_handles[current_port]) {
       current_port = (current_port + 1) % N_IFACE_ON_BOARD;
+      polled++;
       continue;
     }
 
-    const uint8_t *packet = pcap_next(pcap_in_handles[current_port], &hdr);
-    if (packet && hdr.caplen >= IP_OFFSET &&
-        memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) ==
-            0) {
-      // skip outbound
-      continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
-      // TODO: what if len != caplen
-      // Beware: might be larger than MTU because of offloading
-      size_t ip_len = hdr.caplen - IP_OFFSET;
-      size_t real_length = length > ip_len ? ip_len : length;
-      memcpy(buffer, &packet[IP_OFFSET], real_length);
-      memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
-      memcpy(src_mac, &packet[6], sizeof(macaddr_t));
+    int res = receiveFrame(current_port, buffer, length, src_mac, dst_mac);
+    if (res > 0) {
       *if_index = current_port;
-      return ip_len;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x06) {
-      // ARP
-      // learn it
-      macaddr_t mac;
-      memcpy(mac, &packet[22], sizeof(macaddr_t));
-      in_addr_t ip;
-      memcpy(&ip, &packet[28], sizeof(in_addr_t));
-      memcpy(arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-             sizeof(macaddr_t));
-      if (debugEnabled) {
-        fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
-                inet_ntoa(in_addr{ip}));
-      }
-
-      in_addr_t dst_ip;
-      memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
-      // ask me: reply
-      if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
-        // reply
-        uint8_t buffer[64] = {0};
-        // dst mac
-        memcpy(buffer, &packet[6], sizeof(macaddr_t));
-        // src mac
-        macaddr_t mac;
-        HAL_GetInterfaceMacAddress(current_port, mac);
-        memcpy(&buffer[6], mac, sizeof(macaddr_t));
-        // ARP
-        buffer[12] = 0x08;
-        buffer[13] = 0x06;
-        // hardware type
-        buffer[15] = 0x01;
-        // protocol type
-        buffer[16] = 0x08;
-        // hardware size
-        buffer[18] = 0x06;
-        // protocol size
-        buffer[19] = 0x04;
-        // opcode
-        buffer[21] = 0x02;
-        // sender
-        memcpy(&buffer[22], mac, sizeof(macaddr_t));
-        memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
-        // target
-        memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
-        memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
-
-        pcap_inject(pcap_out_handles[current_port], buffer, sizeof(buffer));
-        if (debugEnabled) {
-          fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
-                  inet_ntoa(in_addr{ip}));
-        }
-      }
-      // otherwise: learn and ignore
+      return res;
+    } else if (res < 0) {
       continue;
     }
 
     current_port = (current_port + 1) % N_IFACE_ON_BOARD;
+    polled++;
     // -1 for infinity
-  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1 ||
+           (timeout == 0 && polled < N_IFACE_ON_BOARD));
   return 0;
 }
 
+int HAL_ReceiveIPPacketBurst(int if_index_mask, HAL_IPPacket *packets,
+                             int count, int64_t timeout) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (packets == NULL) || count <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  bool flag = false;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (pcap_in_handles[i] && (if_index_mask & (1 << i))) {
+      flag = true;
+    }
+  }
+  if (!flag) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacketBurst: no viable interfaces open "
+                      "for capture\n");
+    }
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  // the clock is only read while waiting for the first packet
+  int64_t begin = timeout > 0 ? HAL_GetTicks() : 0;
+  // round robin, one packet per interface in turn; carries over to the next
+  // burst so that a busy interface can't starve the others
+  static int current_port = 0;
+  // interfaces polled in a row without a packet
+  int idle = 0;
+  int received = 0;
+  do {
+    if ((if_index_mask & (1 << current_port)) == 0 ||
+        !pcap_in_handles[current_port]) {
+      current_port = (current_port + 1) % N_IFACE_ON_BOARD;
+      idle++;
+      continue;
+    }
+
+    HAL_IPPacket &packet = packets[received];
+    int res = receiveFrame(current_port, packet.buffer, packet.length,
+                           packet.src_mac, packet.dst_mac);
+    if (res > 0) {
+      packet.ip_length = res;
+      packet.if_index = current_port;
+      received++;
+      idle = 0;
+    } else if (res < 0) {
+      continue;
+    } else {
+      idle++;
+    }
+    current_port = (current_port + 1) % N_IFACE_ON_BOARD;
+    // stop once every interface came up empty, wait only for the first packet
+  } while (received < count &&
+           (idle < N_IFACE_ON_BOARD ||
+            (received == 0 &&
+             (timeout == -1 ||
+              (timeout > 0 && (int64_t)HAL_GetTicks() < begin + timeout)))));
+  return received;
+}
+
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac) {
   if (!inited) {
@@ -283,6 +283,28 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   return 0;
 }
 
+int HAL_ReceiveIPPacketBurst(int if_index_mask, HAL_IPPacket *packets,
+                             int count, int64_t timeout) {
+  if (packets == NULL || count <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // packets are read one at a time from the capture, wait only for the first
+  int received = 0;
+  while (received < count) {
+    HAL_IPPacket *packet = &packets[received];
+    int res = HAL_ReceiveIPPacket(if_index_mask, packet->buffer, packet->length,
+                                  packet->src_mac, packet->dst_mac,
+                                  received == 0 ? timeout : 0, &packet->if_index);
+    if (res <= 0) {
+      // an error after some packets is returned by the next call
+      return received ? received : res;
+    }
+    packet->ip_length = res;
+    received++;
+  }
+  return received;
+}
+
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac) {
   if (!inited) {
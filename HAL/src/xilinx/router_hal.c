@@ -294,7 +294,9 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   XAxiDma_Bd *bd;
   uint64_t begin = HAL_GetTicks();
   uint64_t current_time = 0;
-  while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1) {
+  // with timeout 0, the ring is checked once
+  int polled = 0;
+  while (!polled++ || (current_time = HAL_GetTicks()) < begin + timeout || timeout == -1) {
     if (XAxiDma_BdRingFromHw(rxRing, 1, &bd) == 1) {
       // See AXI Ethernet Table 3-15
       u32 length = XAxiDma_BdRead(bd, XAXIDMA_BD_USR4_OFFSET) & 0xFFFF;
@@ -413,6 +415,28 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   return 0;
 }
 
+int HAL_ReceiveIPPacketBurst(int if_index_mask, HAL_IPPacket *packets,
+                             int count, int64_t timeout) {
+  if (packets == NULL || count <= 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  // one buffer descriptor at a time from the DMA ring, wait only for the first
+  int received = 0;
+  while (received < count) {
+    HAL_IPPacket *packet = &packets[received];
+    int res = HAL_ReceiveIPPacket(if_index_mask, packet->buffer, packet->length,
+                                  packet->src_mac, packet->dst_mac,
+                                  received == 0 ? timeout : 0, &packet->if_index);
+    if (res <= 0) {
+      // an error after some packets is returned by the next call
+      return received ? received : res;
+    }
+    packet->ip_length = res;
+    received++;
+  }
+  return received;
+}
+
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac) {
   if (!inited) {
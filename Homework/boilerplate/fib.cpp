@@ -0,0 +1 @@
+../lookup/fib.cpp
\ No newline at end of file
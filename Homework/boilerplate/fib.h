@@ -0,0 +1 @@
+../lookup/fib.h
\ No newline at end of file
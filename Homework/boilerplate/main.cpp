@@ -1,22 +1,53 @@
+#include "fib.h"
+#include "ip_checksum.h"
+#include "ortc.h"
+#include "rib.h"
 #include "rip.h"
 #include "router.h"
 #include "router_hal.h"
+#include "timer.h"
+#include "wire.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
-extern bool validateIPChecksum(uint8_t *packet, size_t len);
+extern size_t classifyIPv4Batch(uint8_t **pkts, const uint32_t *lens, size_t n, const uint32_t *local_addrs,
+                                size_t n_local, uint8_t *verdicts);
+extern void fillUdpChecksum(uint8_t *packet);
+extern uint16_t internetChecksum(const uint8_t *data, size_t len, uint64_t sum);
 extern void update(bool insert, RoutingTableEntry entry, uint32_t if_index = 0);
 extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
-extern bool forward(uint8_t *packet, size_t len);
-extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
-extern uint32_t assemble(const RipPacket *rip, uint8_t *buffer);
-extern void buildRipPacket(RipPacket *resp, uint32_t if_index);
-extern void printRoutingTable();
-
-uint8_t packet[2048];
-uint8_t output[2048];
+extern bool queryFlow(uint32_t addr, uint32_t flow_hash, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+extern uint32_t flowHash(const uint8_t *packet, size_t len);
+extern uint32_t writeRipEntries(uint32_t if_index, bool changed_only, size_t *cursor, uint8_t *buffer, uint32_t max);
+extern bool routeChangesPending();
+extern uint64_t routeTableVersion();
+extern void clearRouteChanges();
+extern void queryCacheStats(uint64_t *hits, uint64_t *misses, uint64_t *cycles_saved);
+
+// warm restart: keep forwarding with the last FIB snapshot while RIP reconverges,
+// it is dropped once learned routes would have timed out anyway (RFC2453 3.8)
+#define FIB_SNAPSHOT_PATH "fib.snapshot"
+#define FIB_SNAPSHOT_HOLD (180 * 1000)
+
+// triggered updates carry only the changed routes, and after one is sent the next
+// waits a random 1-5 s so that a burst of changes goes out together (RFC2453 3.10.1)
+#define TRIGGERED_HOLD_MIN (1 * 1000)
+#define TRIGGERED_HOLD_MAX (5 * 1000)
+#define RIP_UPDATE_INTERVAL (5 * 1000)
+
+// the periodic update and the triggered update hold-down run on the timing wheel
+// together with the route timeouts
+static Timer periodic_timer;
+static Timer triggered_hold;
+static bool periodic_due = false;
+
+static void periodicUpdate(void *) {
+  periodic_due = true;
+}
+
 // 0: 192.168.3.2
 // 1: 192.168.4.1
 // 2: 10.0.2.1
@@ -25,12 +56,549 @@ uint8_t output[2048];
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0203a8c0, 0x0104a8c0, 0x0102000a,
                                      0x0103000a};
 
+// IP + UDP + RIP header, then at most RIP_MAX_ENTRY entries
+#define RIP_DATAGRAM_HEADER (IPv4Wire::size + UdpWire::size + RIP_HEADER_SIZE)
+#define RIP_DATAGRAM_SIZE (RIP_DATAGRAM_HEADER + RIP_MAX_ENTRY * RIP_ENTRY_SIZE)
+// transmit buffers of one batch, RIP_DATAGRAM_SIZE bytes each
+static std::vector<uint8_t> rip_batch;
+
+// fills in the IP and UDP headers of a RIP datagram whose rip_len bytes of RIP are in place
+static void writeRipHeaders(uint8_t *datagram, in_addr_t src_addr, in_addr_t dst_addr, uint32_t rip_len) {
+  // IP
+  IPv4Wire::VersionIhl::store(datagram, 0x45);
+  IPv4Wire::Tos::store(datagram, 0xc0);
+  IPv4Wire::TotalLength::store(datagram, rip_len + IPv4Wire::size + UdpWire::size);
+  IPv4Wire::Id::store(datagram, 0);
+  // don't fragment
+  IPv4Wire::FlagsFragment::store(datagram, 0x4000);
+  IPv4Wire::Ttl::store(datagram, 1);
+  IPv4Wire::Protocol::store(datagram, 17);
+  IPv4Wire::Src::store(datagram, src_addr);
+  IPv4Wire::Dst::store(datagram, dst_addr);
+  ipChecksumFill(datagram);
+  // UDP
+  uint8_t *udp = datagram + IPv4Wire::size;
+  UdpWire::SrcPort::store(udp, RipWire::PORT);
+  UdpWire::DstPort::store(udp, RipWire::PORT);
+  UdpWire::Length::store(udp, rip_len + UdpWire::size);
+  fillUdpChecksum(datagram);
+}
+
+// serialized complete routing table of one interface, addressed to 224.0.0.9
+typedef struct {
+  bool valid;
+  uint64_t version;
+  std::vector<uint8_t> datagrams; // RIP_DATAGRAM_SIZE bytes each
+  std::vector<uint32_t> lengths;
+} RipTableCache;
+
+static RipTableCache rip_cache[N_IFACE_ON_BOARD];
+
+// writes the RIP responses for one interface, one datagram per RIP_DATAGRAM_SIZE bytes
+static void writeRipDatagrams(uint32_t if_index, in_addr_t dst_addr, bool changed_only,
+                              std::vector<uint8_t> &datagrams, std::vector<uint32_t> &lengths) {
+  size_t cursor = 0;
+  lengths.clear();
+  for (;;) {
+    size_t offset = lengths.size() * RIP_DATAGRAM_SIZE;
+    if (datagrams.size() < offset + RIP_DATAGRAM_SIZE) {
+      datagrams.resize(offset + RIP_DATAGRAM_SIZE);
+    }
+    uint8_t *datagram = &datagrams[offset];
+    uint32_t count = writeRipEntries(if_index, changed_only, &cursor, datagram + RIP_DATAGRAM_HEADER, RIP_MAX_ENTRY);
+    if (count == 0) {
+      break;
+    }
+    uint32_t rip_len = RIP_HEADER_SIZE + count * RIP_ENTRY_SIZE;
+    // RIP: response, version 2
+    ripWriteHeader(datagram + RIP_DATAGRAM_HEADER - RIP_HEADER_SIZE, 0x2);
+    writeRipHeaders(datagram, addrs[if_index], dst_addr, rip_len);
+    lengths.push_back(rip_len + IPv4Wire::size + UdpWire::size);
+  }
+}
+
+static void sendRipDatagrams(uint32_t if_index, std::vector<uint8_t> &datagrams,
+                             const std::vector<uint32_t> &lengths, macaddr_t dst_mac) {
+  for (size_t i = 0; i < lengths.size(); i++) {
+    HAL_SendIPPacket(if_index, &datagrams[i * RIP_DATAGRAM_SIZE], lengths[i], dst_mac);
+  }
+}
+
+/**
+ * @brief 把整张路由表作为 RIP Response 发往一个端口，每个 RIP 包最多 RIP_MAX_ENTRY 项
+ * @param if_index 出端口，从这个端口学到的路由不发送（水平分割）
+ * @param dst_addr 目的 IP 地址，大端序
+ * @param dst_mac 目的 MAC 地址
+ *
+ * 每个端口写好的 RIP 包缓存在 rip_cache 中，路由表没有变化时直接重发，
+ * 不再遍历路由表；发往单播地址时只需要改写 IP 和 UDP 头。
+ */
+static void sendRipTable(uint32_t if_index, in_addr_t dst_addr, macaddr_t dst_mac) {
+  RipTableCache &cache = rip_cache[if_index];
+  if (!cache.valid || cache.version != routeTableVersion()) {
+    writeRipDatagrams(if_index, 0x090000e0, false, cache.datagrams, cache.lengths);
+    cache.version = routeTableVersion();
+    cache.valid = true;
+  }
+  if (dst_addr == 0x090000e0) {
+    sendRipDatagrams(if_index, cache.datagrams, cache.lengths, dst_mac);
+    return;
+  }
+  size_t size = cache.lengths.size() * RIP_DATAGRAM_SIZE;
+  if (rip_batch.size() < size) {
+    rip_batch.resize(size);
+  }
+  for (size_t i = 0; i < cache.lengths.size(); i++) {
+    uint8_t *datagram = &rip_batch[i * RIP_DATAGRAM_SIZE];
+    memcpy(datagram, &cache.datagrams[i * RIP_DATAGRAM_SIZE], cache.lengths[i]);
+    writeRipHeaders(datagram, addrs[if_index], dst_addr, cache.lengths[i] - IPv4Wire::size - UdpWire::size);
+  }
+  sendRipDatagrams(if_index, rip_batch, cache.lengths, dst_mac);
+}
+
+/**
+ * @brief 把有变化的路由作为触发更新发往一个端口的 224.0.0.9
+ * @param if_index 出端口，从这个端口学到的路由不发送（水平分割）
+ * @param dst_mac 目的 MAC 地址
+ */
+static void sendRipChanges(uint32_t if_index, macaddr_t dst_mac) {
+  static std::vector<uint32_t> lengths;
+  writeRipDatagrams(if_index, 0x090000e0, true, rip_batch, lengths);
+  sendRipDatagrams(if_index, rip_batch, lengths, dst_mac);
+}
+
+// the receive side sorts packets into two queues: packets for the router itself
+// (our addresses and 224.0.0.9) go to the control queue, which is always drained
+// first, transit packets go to the data queue. Receiving takes more packets per
+// loop than are forwarded, so under a data plane flood the excess is dropped from
+// the data queue instead of piling up in front of RIP packets in the HAL, and a
+// RIP flood is cut down by the per-source token buckets before it takes queue space
+#define RX_BATCH 256
+// packets per HAL_ReceiveIPPacketBurst() call
+#define RX_BURST 32
+#define CONTROL_QUEUE_SIZE 64
+#define DATA_QUEUE_SIZE 256
+// data packets forwarded per loop, then the receive side runs again
+#define DATA_BUDGET 32
+// token buckets of control packet sources, a source hashes to one of a fixed number
+// of buckets so that spoofed sources can't grow the table
+#define RIP_SOURCE_BUCKETS 64
+#define RIP_SOURCE_RATE 1000 // packets per second
+#define RIP_SOURCE_BURST 2000 // packets, the complete table of 50000 routes
+
+// ICMP errors are kept off the forwarding path: it only takes tokens and copies the
+// start of the packet into a small queue, the messages are written and sent after
+// the burst. The global bucket bounds what a flood of expiring packets can cost,
+// the per-source buckets keep one source from using up the global rate
+#define ICMP_QUEUE_SIZE 16
+#define ICMP_RATE 100 // messages per second, all sources together
+#define ICMP_BURST 100
+#define ICMP_SOURCE_BUCKETS 64
+#define ICMP_SOURCE_RATE 10 // messages per second
+#define ICMP_SOURCE_BURST 10
+// as much of the packet as fits into 576 bytes (RFC 1812 4.3.2.3)
+#define ICMP_QUOTE_MAX (576 - IPv4Wire::size - IcmpWire::size)
+
+typedef struct {
+  uint32_t len;
+  int if_index;
+  macaddr_t src_mac;
+  uint8_t data[2048];
+} QueuedPacket;
+
+// both queues hold indices into one pool of packet buffers: a burst is received
+// straight into free buffers and each packet is steered to its queue without a copy
+typedef struct {
+  std::vector<uint32_t> slots;
+  uint32_t head;
+  uint32_t count;
+  uint64_t dropped;
+} PacketQueue;
+
+typedef struct {
+  uint64_t time;
+  uint64_t tokens; // in thousandths of a packet
+} TokenBucket;
+
+typedef struct {
+  uint8_t type;
+  uint8_t code;
+  int if_index;
+  macaddr_t src_mac; // the previous hop, the message goes back to it
+  uint32_t len;
+  uint8_t data[ICMP_QUOTE_MAX];
+} PendingIcmp;
+
+static std::vector<QueuedPacket> packet_pool;
+static std::vector<uint32_t> free_packets;
+static PacketQueue control_queue;
+static PacketQueue data_queue;
+static TokenBucket rip_sources[RIP_SOURCE_BUCKETS];
+static uint64_t rate_limited = 0;
+static PendingIcmp icmp_queue[ICMP_QUEUE_SIZE];
+static uint32_t icmp_count = 0;
+static TokenBucket icmp_bucket;
+static TokenBucket icmp_sources[ICMP_SOURCE_BUCKETS];
+static uint64_t icmp_sent = 0;
+static uint64_t icmp_limited = 0;
+// packets per ipClassify() verdict
+static uint64_t verdict_counts[IP_CLASS_COUNT];
+static const char *verdict_names[IP_CLASS_COUNT] = {
+    "forward", "local", "slow path", "truncated", "bad version", "bad header length", "Invalid IP Checksum",
+    "martian source", "martian destination", "fragment for me", "TTL exceeded"};
+
+static void queueInit(PacketQueue &queue, uint32_t size) {
+  queue.slots.resize(size);
+  queue.head = 0;
+  queue.count = 0;
+  queue.dropped = 0;
+}
+
+// fills the pool with size buffers, enough for both queues and one receive burst
+static void poolInit(uint32_t size) {
+  packet_pool.resize(size);
+  free_packets.clear();
+  for (uint32_t i = size; i-- > 0;) {
+    free_packets.push_back(i);
+  }
+}
+
+// appends the buffer at the tail, false when the queue is full
+static bool queuePush(PacketQueue &queue, uint32_t buffer) {
+  if (queue.count == queue.slots.size()) {
+    queue.dropped++;
+    return false;
+  }
+  queue.slots[(queue.head + queue.count) % queue.slots.size()] = buffer;
+  queue.count++;
+  return true;
+}
+
+// the i-th packet from the head
+static QueuedPacket &queueAt(PacketQueue &queue, uint32_t i) {
+  return packet_pool[queue.slots[(queue.head + i) % queue.slots.size()]];
+}
+
+static QueuedPacket &queueFront(PacketQueue &queue) {
+  return queueAt(queue, 0);
+}
+
+// removes the head and returns its buffer to the pool
+static void queuePop(PacketQueue &queue) {
+  free_packets.push_back(queue.slots[queue.head]);
+  queue.head = (queue.head + 1) % queue.slots.size();
+  queue.count--;
+}
+
+// the same test as ipClassify(), so that only IP_CLASS_LOCAL packets end up in the control queue
+static bool forRouter(in_addr_t dst_addr) {
+  return ipLocalDestination(dst_addr, addrs, N_IFACE_ON_BOARD);
+}
+
+// refills the bucket with rate packets per second up to burst, then takes one token;
+// false when it is empty
+static bool takeToken(TokenBucket &bucket, uint64_t time, uint64_t rate, uint64_t burst) {
+  uint64_t tokens = bucket.tokens + (time - bucket.time) * rate;
+  bucket.tokens = tokens < burst * 1000 ? tokens : burst * 1000;
+  bucket.time = time;
+  if (bucket.tokens < 1000) {
+    return false;
+  }
+  bucket.tokens -= 1000;
+  return true;
+}
+
+// one of 64 buckets for a source address
+static uint32_t sourceBucket(in_addr_t src_addr) {
+  static_assert(RIP_SOURCE_BUCKETS == 64 && ICMP_SOURCE_BUCKETS == 64, "bucket hash");
+  return (src_addr * 0x9e3779b1u) >> 26;
+}
+
+// takes one token from the bucket of src_addr, false when it is empty
+static bool admitControl(in_addr_t src_addr, uint64_t time) {
+  return takeToken(rip_sources[sourceBucket(src_addr)], time, RIP_SOURCE_RATE, RIP_SOURCE_BURST);
+}
+
+/**
+ * @brief 为一个不能转发的包排队一个 ICMP 差错报文，超出速率或者队列满时不发送
+ * @param queued 收到的包，TTL 和校验和保持收到时的样子
+ * @param type ICMP 类型， IcmpWire::TIME_EXCEEDED 或 IcmpWire::DEST_UNREACHABLE
+ * @param code ICMP 代码
+ * @param time 当前时间（毫秒），用于令牌桶
+ *
+ * 报文在 sendIcmpErrors() 中构造和发送，这里只复制包的开头。
+ */
+static void queueIcmpError(const QueuedPacket &queued, uint8_t type, uint8_t code, uint64_t time) {
+  const uint8_t *packet = queued.data;
+  size_t ihl = ipHeaderLength(packet, queued.len);
+  // never about ICMP errors or about any fragment but the first, RFC 1812 4.3.2.7
+  if (IPv4Wire::FlagsFragment::load(packet) & 0x1fff) {
+    return;
+  } else if (IPv4Wire::Protocol::load(packet) == IcmpWire::PROTOCOL && queued.len > ihl) {
+    uint8_t quoted_type = IcmpWire::Type::load(packet + ihl);
+    if (quoted_type == IcmpWire::DEST_UNREACHABLE || quoted_type == IcmpWire::TIME_EXCEEDED ||
+        quoted_type == 4 || quoted_type == 5 || quoted_type == 12) {
+      return;
+    }
+  }
+  if (icmp_count == ICMP_QUEUE_SIZE ||
+      !takeToken(icmp_sources[sourceBucket(IPv4Wire::Src::load(packet))], time, ICMP_SOURCE_RATE,
+                 ICMP_SOURCE_BURST) ||
+      !takeToken(icmp_bucket, time, ICMP_RATE, ICMP_BURST)) {
+    icmp_limited++;
+    return;
+  }
+  PendingIcmp &pending = icmp_queue[icmp_count++];
+  pending.type = type;
+  pending.code = code;
+  pending.if_index = queued.if_index;
+  memcpy(pending.src_mac, queued.src_mac, sizeof(macaddr_t));
+  pending.len = queued.len < ICMP_QUOTE_MAX ? queued.len : ICMP_QUOTE_MAX;
+  memcpy(pending.data, packet, pending.len);
+}
+
+// 发送排队的 ICMP 差错报文，从收到原来的包的端口发回上一跳
+static void sendIcmpErrors() {
+  static uint8_t message[576];
+  for (uint32_t i = 0; i < icmp_count; i++) {
+    PendingIcmp &pending = icmp_queue[i];
+    uint32_t total = IPv4Wire::size + IcmpWire::size + pending.len;
+    // IP: internetwork control precedence (RFC 1812 4.3.2.5)
+    IPv4Wire::VersionIhl::store(message, 0x45);
+    IPv4Wire::Tos::store(message, 0xc0);
+    IPv4Wire::TotalLength::store(message, total);
+    IPv4Wire::Id::store(message, 0);
+    IPv4Wire::FlagsFragment::store(message, 0);
+    IPv4Wire::Ttl::store(message, 64);
+    IPv4Wire::Protocol::store(message, IcmpWire::PROTOCOL);
+    IPv4Wire::Src::store(message, addrs[pending.if_index]);
+    IPv4Wire::Dst::store(message, IPv4Wire::Src::load(pending.data));
+    ipChecksumFill(message);
+    // ICMP, then the start of the original packet
+    uint8_t *icmp = message + IPv4Wire::size;
+    IcmpWire::Type::store(icmp, pending.type);
+    IcmpWire::Code::store(icmp, pending.code);
+    IcmpWire::Checksum::store(icmp, 0);
+    IcmpWire::Unused::store(icmp, 0);
+    memcpy(icmp + IcmpWire::size, pending.data, pending.len);
+    uint16_t checksum = internetChecksum(icmp, IcmpWire::size + pending.len, 0);
+    memcpy(icmp + 2, &checksum, sizeof(checksum));
+    HAL_SendIPPacket(pending.if_index, message, total, pending.src_mac);
+    icmp_sent++;
+  }
+  icmp_count = 0;
+}
+
+// puts a received packet into its queue, false when it is dropped
+static bool steerPacket(const HAL_IPPacket &received, uint32_t buffer, uint64_t time) {
+  QueuedPacket &queued = packet_pool[buffer];
+  if ((size_t)received.ip_length > sizeof(queued.data) || (size_t)received.ip_length < (size_t)IPv4Wire::size) {
+    // packet is truncated or not even an IP header, ignore it
+    return false;
+  }
+  bool control = forRouter(IPv4Wire::Dst::load(queued.data));
+  if (control && !admitControl(IPv4Wire::Src::load(queued.data), time)) {
+    rate_limited++;
+    return false;
+  }
+  queued.len = received.ip_length;
+  queued.if_index = received.if_index;
+  memcpy(queued.src_mac, received.src_mac, sizeof(macaddr_t));
+  return queuePush(control ? control_queue : data_queue, buffer);
+}
+
+/**
+ * @brief 从 HAL 成批收取最多 RX_BATCH 个包，按目的地址放入控制队列或数据队列
+ * @param timeout 第一个包的等待时间（毫秒），之后不再等待
+ * @return 0 表示没有更多的包，否则是 HAL_ReceiveIPPacketBurst 的错误码（包括 HAL_ERR_EOF）
+ *
+ * 每次调用 HAL 收取最多 RX_BURST 个包，直接收进空闲的缓冲区，整批收完再逐个分流。
+ * 控制包先经过源地址的令牌桶，超出速率的直接丢弃；队列满时丢弃新到的包。
+ */
+static int receivePackets(int64_t timeout) {
+  int mask = (1 << N_IFACE_ON_BOARD) - 1;
+  uint64_t time = HAL_GetTicks();
+  HAL_IPPacket burst[RX_BURST];
+  uint32_t buffers[RX_BURST];
+  for (uint32_t n = 0; n < RX_BATCH;) {
+    // leave the rest in the HAL rather than drop RIP packets when the control queue is full
+    uint32_t room = control_queue.slots.size() - control_queue.count;
+    uint32_t count = room < RX_BURST ? room : RX_BURST;
+    if (count == 0) {
+      break;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      buffers[i] = free_packets.back();
+      free_packets.pop_back();
+      burst[i].buffer = packet_pool[buffers[i]].data;
+      burst[i].length = sizeof(packet_pool[buffers[i]].data);
+    }
+    int res = HAL_ReceiveIPPacketBurst(mask, burst, count, n == 0 ? timeout : 0);
+    uint32_t received = res > 0 ? res : 0;
+    for (uint32_t i = 0; i < count; i++) {
+      if (i >= received || !steerPacket(burst[i], buffers[i], time)) {
+        free_packets.push_back(buffers[i]);
+      }
+    }
+    if (received < count) {
+      return res < 0 ? res : 0;
+    }
+    n += count;
+  }
+  return 0;
+}
+
+// 处理发给路由器自己的包：RIP Request 和 Response
+static void handleControlPacket(QueuedPacket &queued) {
+  uint8_t *packet = queued.data;
+  // 1. validate, RipPacketView reads past IP options by itself
+  uint8_t verdict = ipClassify(packet, queued.len, ipChecksumValid(packet, queued.len), addrs, N_IFACE_ON_BOARD);
+  verdict_counts[verdict]++;
+  if (verdict >= IP_CLASS_DROP) {
+    printf("%s\n", verdict_names[verdict]);
+    return;
+  }
+  // big endian
+  in_addr_t src_addr = IPv4Wire::Src::load(packet);
+  printf("dst is me...\n");
+  // 3a.1
+  // check and validate, the view reads the entries in place from packet
+  RipPacketView rip;
+  if (!rip.parse(packet, queued.len)) {
+    return;
+  }
+  if (rip.command() == 1) {
+    printf("receive request...\n");
+    // 3a.3 request, ref. RFC2453 3.9.1
+    // only need to respond to whole table requests in the lab
+    // reply from the receiving interface, not from 224.0.0.9
+    sendRipTable(queued.if_index, src_addr, queued.src_mac);
+  } else {
+    printf("receive response...\n");
+    // 3a.2 response, ref. RFC2453 3.9.2
+    // the whole response is one transaction: exact (addr, len) matches in the RIB,
+    // one FIB publish, changed routes go out in the next triggered update
+    RibTransaction txn;
+    txn.applyResponse(rip, queued.if_index, src_addr);
+    printf("%u routes changed\n", txn.commit());
+  }
+}
+
+// 慢速路径：带选项的包不处理选项，返回 true 照常转发；其余的包按原因丢弃，
+// TTL 耗尽时排队一个 ICMP Time Exceeded
+static bool handleSlowPacket(QueuedPacket &queued, uint8_t verdict, uint64_t time) {
+  if (verdict == IP_CLASS_SLOW) {
+    printf("IP options ignored\n");
+    return true;
+  }
+  printf("%s\n", verdict_names[verdict]);
+  if (verdict == IP_CLASS_DROP_TTL) {
+    // time to live exceeded in transit
+    queueIcmpError(queued, IcmpWire::TIME_EXCEEDED, 0, time);
+  }
+  return false;
+}
+
+/**
+ * @brief 转发数据队列头部的最多 DATA_BUDGET 个包，每一步对整批包做完再做下一步
+ * @param time 当前时间（毫秒）
+ *
+ * 依次是 classifyIPv4Batch() 检查和分类、查路由、查下一跳的 MAC 地址、修改 TTL 并发送，
+ * 每一步只处理上一步留下的包；一步的代码和数据在整批包之间留在缓存中，
+ * 连续发往同一个下一跳的包只查一次 ARP 。
+ */
+static void forwardBurst(uint64_t time) {
+  QueuedPacket *burst[DATA_BUDGET];
+  uint8_t *headers[DATA_BUDGET];
+  uint32_t lens[DATA_BUDGET];
+  uint8_t verdicts[DATA_BUDGET];
+  uint32_t nexthops[DATA_BUDGET];
+  uint32_t dest_ifs[DATA_BUDGET];
+  macaddr_t dest_macs[DATA_BUDGET];
+  // positions in the burst still to be sent, in queue order
+  uint32_t pending[DATA_BUDGET];
+  uint32_t n = data_queue.count < DATA_BUDGET ? data_queue.count : DATA_BUDGET;
+  if (n == 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    burst[i] = &queueAt(data_queue, i);
+    headers[i] = burst[i]->data;
+    lens[i] = burst[i]->len;
+  }
+
+  // 1. validate and classify, packets with options take the slow path
+  classifyIPv4Batch(headers, lens, n, addrs, N_IFACE_ON_BOARD, verdicts);
+  uint32_t m = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    verdict_counts[verdicts[i]]++;
+    if (verdicts[i] == IP_CLASS_FORWARD || handleSlowPacket(*burst[i], verdicts[i], time)) {
+      pending[m++] = i;
+    }
+  }
+
+  // route lookup, 3b.1 dst is not me
+  uint32_t routed = 0;
+  for (uint32_t j = 0; j < m; j++) {
+    uint32_t i = pending[j];
+    // big endian
+    in_addr_t dst_addr = IPv4Wire::Dst::load(headers[i]);
+    uint32_t metric;
+    if (queryFlow(dst_addr, flowHash(headers[i], lens[i]), &nexthops[i], &dest_ifs[i], &metric)) {
+      // direct routing
+      if (nexthops[i] == 0) {
+        nexthops[i] = dst_addr;
+      }
+      pending[routed++] = i;
+    } else {
+      // not found: network unreachable
+      printf("IP not found for %x\n", IPv4Wire::Src::load(headers[i]));
+      queueIcmpError(*burst[i], IcmpWire::DEST_UNREACHABLE, 0, time);
+    }
+  }
+
+  // next hop MAC address, reused while the next hop stays the same
+  uint32_t resolved = 0;
+  uint32_t last = DATA_BUDGET;
+  bool last_found = false;
+  for (uint32_t j = 0; j < routed; j++) {
+    uint32_t i = pending[j];
+    if (last < DATA_BUDGET && dest_ifs[i] == dest_ifs[last] && nexthops[i] == nexthops[last]) {
+      memcpy(dest_macs[i], dest_macs[last], sizeof(macaddr_t));
+    } else {
+      last = i;
+      last_found = HAL_ArpGetMacAddress(dest_ifs[i], nexthops[i], dest_macs[i]) == 0;
+    }
+    if (last_found) {
+      pending[resolved++] = i;
+    } else {
+      // not found: host unreachable
+      printf("ARP not found for %x\n", nexthops[i]);
+      queueIcmpError(*burst[i], IcmpWire::DEST_UNREACHABLE, 1, time);
+    }
+  }
+
+  // decrement TTL and update the checksum incrementally, errors above quote the packet as received
+  for (uint32_t j = 0; j < resolved; j++) {
+    uint32_t i = pending[j];
+    ipDecrementTtl(headers[i]);
+    HAL_SendIPPacket(dest_ifs[i], headers[i], lens[i], dest_macs[i]);
+  }
+  if (resolved) {
+    printf("forwarded %u packets\n", resolved);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    queuePop(data_queue);
+  }
+}
+
 int main(int argc, char *argv[]) {
   // 0a.
   int res = HAL_Init(1, addrs);
   if (res < 0) {
     return res;
   }
+  timerStart(HAL_GetTicks());
 
   // 0b. Add direct routes
   // For example:
@@ -44,255 +612,117 @@ int main(int argc, char *argv[]) {
         .len = 24,        // small endian
         .if_index = i,    // small endian
         .nexthop = 0,      // big endian, means direct
-        .metric = 0
+        .metric = 0,
+        .changed = false,
+        .timeout = NULL
     };
     update(true, entry);
   }
 
-  uint64_t last_time = 0;
+  // 0c. Warm restart from the last FIB snapshot, the range engine has no FIB to snapshot
+  uint64_t start_time = HAL_GetTicks();
+#ifndef LOOKUP_ENGINE_RANGE
+  bool warm = fibLoadSnapshot(FIB_SNAPSHOT_PATH);
+  if (warm) {
+    printf("FIB snapshot loaded in %llu ms\n",
+           (unsigned long long)(HAL_GetTicks() - start_time));
+  }
+  fibStartSnapshotWriter(FIB_SNAPSHOT_PATH, 5 * 1000);
+#endif
+
+  srand(addrs[0] ^ (uint32_t)start_time);
+  timerInit(&periodic_timer, periodicUpdate, NULL);
+  timerInit(&triggered_hold, NULL, NULL);
+  timerArm(&periodic_timer, 0);
+  poolInit(CONTROL_QUEUE_SIZE + DATA_QUEUE_SIZE + RX_BURST);
+  queueInit(control_queue, CONTROL_QUEUE_SIZE);
+  queueInit(data_queue, DATA_QUEUE_SIZE);
+  bool eof = false;
   while (1) {
     uint64_t time = HAL_GetTicks();
-    if (time > last_time + 5 * 1000) {
+    // route timeouts and garbage collection happen in here
+    timerRun(time);
+    if (periodic_due) {
+      periodic_due = false;
+      timerArm(&periodic_timer, RIP_UPDATE_INTERVAL);
       // What to do?
       // send complete routing table to every interface
       // ref. RFC2453 3.8
       // multicast MAC for 224.0.0.9 is 01:00:5e:00:00:09
       for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
-        output[0] = 0x45;
-        output[1] = 0xc0;
-        output[4] = 0x00;
-        output[5] = 0x00;
-        output[6] = 0x40;
-        output[7] = 0x00;
-        output[8] = 0x01;
-        output[9] = 0x11;
-        output[12] = (uint8_t)(addrs[i] & 0xff);
-        output[13] = (uint8_t)((addrs[i] >> 8) & 0xff);
-        output[14] = (uint8_t)((addrs[i] >> 16) & 0xff);
-        output[15] = (uint8_t)((addrs[i] >> 24) & 0xff);
-        output[16] = 0xe0;
-        output[17] = 0x00;
-        output[18] = 0x00;
-        output[19] = 0x09;
-        // ...
-        // UDP
-        // port = 520
-        output[20] = 0x02;
-        output[21] = 0x08;
-        output[22] = 0x02;
-        output[23] = 0x08;
-        output[26] = 0x00;
-        output[27] = 0x00;
-        // ...
-        // RIP
-        RipPacket resp;
-        buildRipPacket(&resp, i);
-        uint32_t rip_len = assemble(&resp, &output[20 + 8]);
-        output[2] = (uint8_t) ((rip_len + 28) >> 8);
-        output[3] = (uint8_t) rip_len + 28;
-        output[24] = (uint8_t) ((rip_len + 8) >> 8);
-        output[25] = (uint8_t) rip_len + 8;
-        unsigned long checksum = 0;
-        for (uint8_t j = 0; j < 20; j += 2) {
-          if (j != 10) {
-            checksum += (((unsigned long)output[j] << 8) + (unsigned long)output[j + 1]);
-          }
-        }
-        checksum = (checksum >> 16) + (checksum & 0xffff);
-        checksum += checksum >> 16;
-        output[10] = (uint8_t)((~checksum) >> 8);
-        output[11] = (uint8_t)(~checksum);
         macaddr_t dst_mac;
-        HAL_ArpGetMacAddress(0, 0x090000e0, dst_mac);
-        HAL_SendIPPacket(i, output, rip_len + 20 + 8, dst_mac);
+        HAL_ArpGetMacAddress(i, 0x090000e0, dst_mac);
+        sendRipTable(i, 0x090000e0, dst_mac);
       }
+      // the complete table carries every change as well
+      clearRouteChanges();
       printf("5s Timer\n");
-      last_time = time;
+      uint64_t hits, misses, cycles_saved;
+      queryCacheStats(&hits, &misses, &cycles_saved);
+      printf("query cache: %llu hits, %llu misses, %llu cycles saved\n",
+             (unsigned long long)hits, (unsigned long long)misses,
+             (unsigned long long)cycles_saved);
+#ifndef LOOKUP_ENGINE_RANGE
+      uint32_t rib_prefixes, fib_prefixes;
+      ortcStats(&rib_prefixes, &fib_prefixes);
+      printf("FIB: %u prefixes aggregated from %u routes\n", fib_prefixes,
+             rib_prefixes);
+#endif
+      printf("receive: %llu transit packets dropped, %llu control packets rate limited\n",
+             (unsigned long long)data_queue.dropped, (unsigned long long)rate_limited);
+      uint64_t dropped = 0;
+      for (int i = IP_CLASS_DROP; i < IP_CLASS_COUNT; i++) {
+        dropped += verdict_counts[i];
+      }
+      printf("icmp: %llu errors sent, %llu rate limited\n", (unsigned long long)icmp_sent,
+             (unsigned long long)icmp_limited);
+      printf("classify: %llu forwarded, %llu local, %llu slow path, %llu dropped\n",
+             (unsigned long long)verdict_counts[IP_CLASS_FORWARD], (unsigned long long)verdict_counts[IP_CLASS_LOCAL],
+             (unsigned long long)verdict_counts[IP_CLASS_SLOW], (unsigned long long)dropped);
+#ifndef LOOKUP_ENGINE_RANGE
+      if (warm && time > start_time + FIB_SNAPSHOT_HOLD) {
+        fibDropSnapshot();
+        warm = false;
+      }
+#endif
+    } else if (routeChangesPending() && !timerPending(&triggered_hold)) {
+      // triggered update, ref. RFC2453 3.10.1
+      for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
+        macaddr_t dst_mac;
+        HAL_ArpGetMacAddress(i, 0x090000e0, dst_mac);
+        sendRipChanges(i, dst_mac);
+      }
+      clearRouteChanges();
+      timerArm(&triggered_hold, TRIGGERED_HOLD_MIN + rand() % (TRIGGERED_HOLD_MAX - TRIGGERED_HOLD_MIN + 1));
+      printf("Triggered update\n");
     }
 
-    int mask = (1 << N_IFACE_ON_BOARD) - 1;
-    macaddr_t src_mac;
-    macaddr_t dst_mac;
-    int if_index;
-    res = HAL_ReceiveIPPacket(mask, packet, sizeof(packet), src_mac, dst_mac,
-                              1000, &if_index);
-    if (res == HAL_ERR_EOF) {
+    if (eof && control_queue.count == 0 && data_queue.count == 0) {
       break;
-    } else if (res < 0) {
-      return res;
-    } else if (res == 0) {
-      // Timeout
-      continue;
-    } else if (res > sizeof(packet)) {
-      // packet is truncated, ignore it
-      continue;
     }
 
-    // 1. validate
-    if (!validateIPChecksum(packet, res)) {
-      printf("Invalid IP Checksum\n");
-      continue;
+    // wake up in time for the next timer, the periodic update is always armed;
+    // don't wait while packets are queued
+    int64_t timeout = control_queue.count || data_queue.count ? 0 : timerNextTimeout(RIP_UPDATE_INTERVAL);
+    res = eof ? 0 : receivePackets(timeout);
+    if (res == HAL_ERR_EOF) {
+      // handle what is already queued first
+      eof = true;
+    } else if (res < 0) {
+      fibStopSnapshotWriter();
+      return res;
     }
-    in_addr_t src_addr, dst_addr;
-    src_addr = (in_addr_t)packet[12];
-    src_addr += ((in_addr_t)packet[13]) << 8;
-    src_addr += ((in_addr_t)packet[14]) << 16;
-    src_addr += ((in_addr_t)packet[15]) << 24;
-    dst_addr = (in_addr_t)packet[16];
-    dst_addr += ((in_addr_t)packet[17]) << 8;
-    dst_addr += ((in_addr_t)packet[18]) << 16;
-    dst_addr += ((in_addr_t)packet[19]) << 24;
-    // extract src_addr and dst_addr from packet
-    // big endian
 
-    // 2. check whether dst is me
-    bool dst_is_me = false;
-    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-      if (memcmp(&dst_addr, &addrs[i], sizeof(in_addr_t)) == 0) {
-        dst_is_me = true;
-        break;
-      }
-    }
-    // TODO: Handle rip multicast address(224.0.0.9)?
-    if (dst_addr == 0x090000e0) {
-      dst_is_me = true;
+    // RIP first, then a bounded number of transit packets
+    while (control_queue.count) {
+      handleControlPacket(queueFront(control_queue));
+      queuePop(control_queue);
     }
-
-    if (dst_is_me) {
-      printf("dst is me...\n");
-      // 3a.1
-      RipPacket rip;
-      // check and validate
-      if (disassemble(packet, res, &rip)) {
-        if (rip.command == 1) {
-          printf("receive request...\n");
-          // 3a.3 request, ref. RFC2453 3.9.1
-          // only need to respond to whole table requests in the lab
-          RipPacket resp;
-          buildRipPacket(&resp, if_index);
-          // TODO: fill resp
-          // assemble
-          // IP
-          output[0] = 0x45;
-          output[1] = 0xc0;
-          output[4] = 0x00;
-          output[5] = 0x00;
-          output[6] = 0x40;
-          output[7] = 0x00;
-          output[8] = 0x01;
-          output[9] = 0x11;
-          output[12] = (uint8_t)(dst_addr & 0xff);
-          output[13] = (uint8_t)((dst_addr >> 8) & 0xff);
-          output[14] = (uint8_t)((dst_addr >> 16) & 0xff);
-          output[15] = (uint8_t)((dst_addr >> 24) & 0xff);
-          output[16] = (uint8_t)(src_addr & 0xff);
-          output[17] = (uint8_t)((src_addr >> 8) & 0xff);
-          output[18] = (uint8_t)((src_addr >> 16) & 0xff);
-          output[19] = (uint8_t)((src_addr >> 24) & 0xff);
-          // ...
-          // UDP
-          // port = 520
-          output[20] = 0x02;
-          output[21] = 0x08;
-          output[22] = 0x02;
-          output[23] = 0x08;
-          // ...
-          // RIP
-          uint32_t rip_len = assemble(&resp, &output[20 + 8]);
-          output[2] = (uint8_t) ((rip_len + 28) >> 8);
-          output[3] = (uint8_t) rip_len + 28;
-          output[24] = (uint8_t) ((rip_len + 8) >> 8);
-          output[25] = (uint8_t) rip_len + 8;
-          // TODO: checksum
-          // checksum calculation for ip and udp
-          unsigned long checksum = 0;
-          for (uint8_t i = 0; i < 20; i += 2) {
-            if (i != 10) {
-              checksum += (((unsigned long)output[i] << 8) + (unsigned long)output[i + 1]);
-            }
-          }
-          checksum = (checksum >> 16) + (checksum & 0xffff);
-          checksum += checksum >> 16;
-          output[10] = (uint8_t)((~checksum) >> 8);
-          output[11] = (uint8_t)~checksum;
-          output[26] = 0x00;
-          output[27] = 0x00;
-          // if you don't want to calculate udp checksum, set it to zero
-          // send it back
-          HAL_SendIPPacket(if_index, output, rip_len + 20 + 8, src_mac);
-        } else {
-          printf("receive response...\n");
-          // 3a.2 response, ref. RFC2453 3.9.2
-          // update routing table
-          // new metric = ?
-          // update metric, if_index, nexthop
-          // what is missing from RoutingTableEntry?
-          // TODO: use query and update
-          // triggered updates? ref. RFC2453 3.10.1
-          uint32_t count = rip.numEntries;
-          for (uint32_t i = 0; i < count; i++) {
-            uint32_t nexthop, dest_if, metric;
-            uint32_t len = 0;
-            uint32_t seMask = ntohl(rip.entries[i].mask);
-            for (int j = 0; j < 32; j++) {
-              if((seMask >> j) % 2 == 1) {
-                len = 32 - j;
-                break;
-              }
-            }
-            RoutingTableEntry tableEntry = {
-                .addr = rip.entries[i].addr,
-                .len = len,
-                .if_index = (uint32_t) if_index,
-                .nexthop = src_addr,
-                .metric = rip.entries[i].metric
-            };
-            if (ntohl(rip.entries[i].metric) > 16) {
-              update(false, tableEntry, if_index);
-            }
-            if (query(rip.entries[i].addr, &nexthop, &dest_if, &metric)) {
-              if(ntohl(rip.entries[i].metric) <= ntohl(metric)) {
-                update(true, tableEntry);
-              }
-            } else {
-              update(true, tableEntry);
-            }
-          }
-          printRoutingTable();
-        }
-      }
-    } else {
-      printf("dst is not me...\n");
-      // 3b.1 dst is not me
-      // forward
-      // beware of endianness
-      uint32_t nexthop, dest_if, metric;
-      if (query(dst_addr, &nexthop, &dest_if, &metric)) {
-        // found
-        macaddr_t dest_mac;
-        // direct routing
-        if (nexthop == 0) {
-          nexthop = dst_addr;
-        }
-        if (HAL_ArpGetMacAddress(dest_if, nexthop, dest_mac) == 0) {
-          // found
-          memcpy(output, packet, res);
-          // update ttl and checksum
-          if (forward(output, res)) {
-            printf("forwarding...\n");
-            HAL_SendIPPacket(dest_if, output, res, dest_mac);
-          }
-        } else {
-          // not found
-          // you can drop it
-          printf("ARP not found for %x\n", nexthop);
-        }
-      } else {
-        // not found
-        // optionally you can send ICMP Host Unreachable
-        printf("IP not found for %x\n", src_addr);
-      }
+    forwardBurst(time);
+    if (icmp_count) {
+      sendIcmpErrors();
     }
   }
+  fibStopSnapshotWriter();
   return 0;
 }
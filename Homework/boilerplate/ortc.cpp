@@ -0,0 +1 @@
+../lookup/ortc.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../lookup/ortc.h
\ No newline at end of file
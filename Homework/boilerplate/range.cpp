@@ -0,0 +1 @@
+../lookup/range.cpp
\ No newline at end of file
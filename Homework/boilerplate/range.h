@@ -0,0 +1 @@
+../lookup/range.h
\ No newline at end of file
@@ -0,0 +1 @@
+../lookup/rib.h
\ No newline at end of file
@@ -0,0 +1 @@
+../protocol/rip_validate.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../lookup/timer.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../lookup/timer.h
\ No newline at end of file
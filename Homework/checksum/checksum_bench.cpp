@@ -0,0 +1,536 @@
+#include "ip_checksum.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <chrono>
+using std::vector;
+
+// ip_checksum.h 的测试和性能测试：随机生成带选项或不带选项的 IP 头，
+// 检查校验、填写和转发的结果与原来逐字节移位的写法一致，
+// 再测量两种写法每个包的周期数。
+// validateIPChecksumBatch() 的结果与逐个调用 validateIPChecksum() 比较，
+// 并测量两者每纳秒检查的头部个数，头部像接收队列中一样相隔 2048 字节。
+// internetChecksum() 和 fillUdpChecksum() 的结果与逐字节求和比较，
+// 再测量逐字节求和、ipChecksumAdd() 和 internetChecksum() 在不同长度下的 GB/s 。
+// classifyIPv4Batch() 的结果与逐项用 if 判断的写法比较，再测量两者在不同比例的畸形包下每个包的纳秒数。
+
+#define N_CASES 1000000
+#define N_HEADERS 4096
+#define N_ROUNDS 2000
+
+#define N_SLOTS 256
+#define SLOT_SIZE 2048
+#define N_BATCH_ROUNDS 20000
+
+#define N_PAYLOADS 200000
+#define PAYLOAD_MAX 2048
+#define PAYLOAD_BYTES (1 << 30)
+
+extern bool validateIPChecksum(uint8_t *packet, size_t len);
+extern size_t validateIPChecksumBatch(uint8_t **pkts, size_t n, uint8_t *bad);
+extern uint16_t internetChecksum(const uint8_t *data, size_t len, uint64_t sum);
+extern void fillUdpChecksum(uint8_t *packet);
+extern size_t classifyIPv4Batch(uint8_t **pkts, const uint32_t *lens, size_t n, const uint32_t *local_addrs,
+                                size_t n_local, uint8_t *verdicts);
+
+// 10.0.0.1, 10.0.1.1, 10.0.2.1, 10.0.3.1 as the boilerplate numbers its ports
+static const uint32_t local_addrs[] = {0x0100000a, 0x0101000a, 0x0102000a, 0x0103000a};
+#define N_LOCAL (sizeof(local_addrs) / sizeof(local_addrs[0]))
+
+// what validateIPChecksum() used to do
+static bool validateBytewise(uint8_t *packet, size_t len) {
+  uint8_t length = 4 * (packet[0] & 0xf);
+  unsigned long checksum = 0;
+  unsigned short realchecksum = 0;
+  for (uint8_t i = 0; i < length; i += 2) {
+    if (i == 10) {
+      realchecksum = ((unsigned short)packet[i] << 8) + (unsigned short)packet[i + 1];
+    } else {
+      checksum += (((unsigned long)packet[i] << 8) + (unsigned long)packet[i + 1]);
+    }
+  }
+  checksum = (checksum >> 16) + (checksum & 0xffff);
+  checksum += checksum >> 16;
+  return realchecksum == ((unsigned short)~checksum);
+}
+
+// what forward() used to do: check, decrement TTL, sum the header again
+static bool forwardBytewise(uint8_t *packet, size_t len) {
+  if (!validateBytewise(packet, len)) {
+    return false;
+  }
+  uint8_t length = 4 * (packet[0] & 0xf);
+  packet[8] -= 1;
+  if (packet[8] == 0) {
+    return false;
+  }
+  unsigned long checksum = 0;
+  for (uint8_t i = 0; i < length; i += 2) {
+    if (i != 10) {
+      checksum += (((unsigned long)packet[i] << 8) + (unsigned long)packet[i + 1]);
+    }
+  }
+  checksum = (checksum >> 16) + (checksum & 0xffff);
+  checksum += checksum >> 16;
+  packet[10] = (uint8_t)((~checksum) >> 8);
+  packet[11] = (uint8_t)~checksum;
+  return true;
+}
+
+// the big-endian byte pair loop of RFC 1071 4.1, folded to 16 bits
+static uint16_t sumBytewise(const uint8_t *data, size_t len, uint32_t sum) {
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (uint32_t)data[i] << 8 | data[i + 1];
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  if (len & 1) {
+    sum += (uint32_t)data[len - 1] << 8;
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return (uint16_t)sum;
+}
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// a header of 5 to 15 words (20 if options is false), a valid checksum most of the time
+static void randomHeader(uint8_t *header, bool options) {
+  uint32_t ihl = options ? 5 + xorshift() % 11 : 5;
+  for (uint32_t i = 0; i < 60; i++) {
+    header[i] = xorshift();
+  }
+  header[0] = 0x40 | ihl;
+  // keep TTL above 1 in most headers so that forwarding takes the whole path
+  if (xorshift() % 8) {
+    header[8] |= 2;
+  }
+  if (xorshift() % 4) {
+    ipChecksumFill(header);
+  }
+}
+
+static bool check() {
+  uint8_t header[60], expected[60];
+  uint32_t errors = 0, negative_zero = 0, ttl_zero = 0;
+  for (uint32_t i = 0; i < N_CASES; i++) {
+    randomHeader(header, i & 1);
+    size_t len = 4 * (header[0] & 0xf);
+    bool valid = validateIPChecksum(header, len);
+    if (valid != validateBytewise(header, len)) {
+      // 0x0000 and 0xffff both stand for a zero sum (RFC 1624 3), the old code only took one
+      uint16_t stored = (uint16_t)(header[10] << 8 | header[11]);
+      if (valid && stored == 0xffff) {
+        negative_zero++;
+      } else if (errors++ < 10) {
+        printf("validate differs: ihl %u\n", header[0] & 0xf);
+      }
+      continue;
+    }
+    memcpy(expected, header, len);
+    if (valid && header[8] == 0) {
+      // the old code wrapped TTL 0 around to 255 and forwarded the packet
+      ttl_zero++;
+      if (ipForwardHeader(header, len) != IP_FORWARD_TTL_EXCEEDED && errors++ < 10) {
+        printf("TTL 0 forwarded\n");
+      }
+      continue;
+    }
+    bool forwarded = ipForwardHeader(header, len) == IP_FORWARD_OK;
+    bool expected_forwarded = forwardBytewise(expected, len);
+    if (forwarded != expected_forwarded || (forwarded && memcmp(header, expected, len) != 0)) {
+      if (errors++ < 10) {
+        printf("forward differs: ihl %u, ttl %u\n", header[0] & 0xf, header[8]);
+      }
+    } else if (forwarded && !ipChecksumValid(header, len)) {
+      if (errors++ < 10) {
+        printf("forwarded header has a bad checksum\n");
+      }
+    }
+  }
+  printf("check: %u cases, %u errors, %u accepted with a 0xffff checksum, %u dropped with TTL 0\n", N_CASES,
+         errors, negative_zero, ttl_zero);
+  return errors == 0;
+}
+
+// the IGMP report of HAL_JoinIGMPGroup() with its 24 byte header, and the old loop
+static bool checkIgmp() {
+  uint8_t header[24] = {0x46, 0xc0, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x01, 0x02, 0x00, 0x00,
+                        0x0a, 0x00, 0x02, 0x01, 0xe0, 0x00, 0x00, 0x16, 0x94, 0x04, 0x00, 0x00};
+  uint32_t ip_chksum = 0;
+  for (int i = 0; i < 12; i++) {
+    uint16_t word;
+    memcpy(&word, header + 2 * i, sizeof(word));
+    ip_chksum += word;
+  }
+  while (ip_chksum >= 0x10000) {
+    ip_chksum -= 0x10000;
+    ip_chksum += 1;
+  }
+  uint16_t chksum = ~ip_chksum;
+  ipChecksumFill(header);
+  bool ok = memcmp(header + 10, &chksum, sizeof(chksum)) == 0;
+  printf("IGMP report: %s\n", ok ? "ok" : "differs");
+  return ok;
+}
+
+// TSC on x86, nanoseconds elsewhere
+static inline uint64_t cycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// every round runs over all headers, the TTL is set back before each forwarding round
+template <typename F>
+static double cyclesPerPacket(vector<uint8_t> &headers, F run) {
+  uint64_t sink = 0, total = 0;
+  for (uint32_t round = 0; round < N_ROUNDS; round++) {
+    for (uint32_t i = 0; i < N_HEADERS; i++) {
+      headers[i * 60 + 8] = 64;
+      ipChecksumFill(&headers[i * 60]);
+    }
+    uint64_t begin = cycleCounter();
+    for (uint32_t i = 0; i < N_HEADERS; i++) {
+      sink += run(&headers[i * 60]);
+    }
+    total += cycleCounter() - begin;
+  }
+  if (sink == 0) {
+    printf("nothing done\n");
+  }
+  return (double)total / N_ROUNDS / N_HEADERS;
+}
+
+// batches of 0 to 67 headers, some of them with options, against one call per header
+static bool checkBatch() {
+  vector<uint8_t> slots(N_SLOTS * SLOT_SIZE);
+  uint8_t *pkts[N_SLOTS];
+  uint8_t bad_bits[N_SLOTS / 8];
+  uint32_t errors = 0;
+  for (uint32_t round = 0; round < N_CASES / 64; round++) {
+    size_t n = xorshift() % 68;
+    for (size_t i = 0; i < n; i++) {
+      pkts[i] = &slots[(xorshift() % N_SLOTS) * SLOT_SIZE];
+      randomHeader(pkts[i], xorshift() % 8 == 0);
+    }
+    // a batch may use the same slot twice, check against the final contents
+    size_t expected_bad = 0;
+    for (size_t i = 0; i < n; i++) {
+      expected_bad += !validateIPChecksum(pkts[i], 60);
+    }
+    size_t bad = validateIPChecksumBatch(pkts, n, bad_bits);
+    bool same = bad == expected_bad;
+    for (size_t i = 0; i < n; i++) {
+      same = same && ((bad_bits[i / 8] >> (i % 8)) & 1) == !validateIPChecksum(pkts[i], 60);
+    }
+    if (!same && errors++ < 10) {
+      printf("batch of %zu differs\n", n);
+    }
+  }
+  printf("batch: %u batches, %u errors\n", N_CASES / 64, errors);
+  return errors == 0;
+}
+
+// random lengths and alignments against the byte pair loop, then UDP datagrams with the pseudo header
+static bool checkPayload() {
+  vector<uint8_t> buffer(PAYLOAD_MAX + 64);
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < N_PAYLOADS; i++) {
+    size_t offset = xorshift() % 32;
+    size_t len = i % 4 ? xorshift() % PAYLOAD_MAX : xorshift() % 128;
+    uint8_t *data = &buffer[offset];
+    for (size_t k = 0; k < len; k++) {
+      data[k] = xorshift();
+    }
+    // bytewise sums are big-endian, internetChecksum() is in host order like the packet
+    uint16_t expected = (uint16_t)~sumBytewise(data, len, 0);
+    uint16_t checksum = internetChecksum(data, len, 0);
+    uint8_t stored[2];
+    memcpy(stored, &checksum, sizeof(checksum));
+    if ((uint16_t)(stored[0] << 8 | stored[1]) != expected && errors++ < 10) {
+      printf("payload of %zu bytes at offset %zu differs\n", len, offset);
+    }
+  }
+  for (uint32_t i = 0; i < N_PAYLOADS / 8; i++) {
+    uint8_t *packet = &buffer[0];
+    size_t udp_len = 8 + xorshift() % (PAYLOAD_MAX - 20 - 8);
+    for (size_t k = 0; k < 20 + udp_len; k++) {
+      packet[k] = xorshift();
+    }
+    packet[0] = 0x45;
+    packet[9] = 17;
+    packet[24] = (uint8_t)(udp_len >> 8);
+    packet[25] = (uint8_t)udp_len;
+    fillUdpChecksum(packet);
+    // pseudo header: addresses, zero and protocol, UDP length
+    uint8_t pseudo[12] = {packet[12], packet[13], packet[14], packet[15], packet[16], packet[17],
+                          packet[18], packet[19], 0, 17, packet[24], packet[25]};
+    uint16_t sum = sumBytewise(packet + 20, udp_len, sumBytewise(pseudo, sizeof(pseudo), 0));
+    bool zero = packet[26] == 0 && packet[27] == 0;
+    if ((sum != 0xffff || zero) && errors++ < 10) {
+      printf("UDP checksum of %zu bytes wrong\n", udp_len);
+    }
+  }
+  printf("payload: %u buffers, %u UDP datagrams, %u errors\n", N_PAYLOADS, N_PAYLOADS / 8, errors);
+  return errors == 0;
+}
+
+// sums PAYLOAD_BYTES in buffers of len bytes, at 32 different alignments so that no round can be skipped
+template <typename F>
+static double gigabytesPerSecond(const uint8_t *data, size_t len, F run) {
+  uint64_t sink = 0;
+  size_t rounds = PAYLOAD_BYTES / len;
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    sink += run(data + round % 32, len);
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (sink == 0) {
+    printf("nothing summed\n");
+  }
+  return (double)rounds * len / std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+// the same decisions as ipClassify(), one if after another
+static uint8_t classifyBranchy(const uint8_t *h, size_t len) {
+  if (len < 20 || (size_t)(h[2] << 8 | h[3]) > len) {
+    return IP_CLASS_DROP_TRUNCATED;
+  }
+  if (h[0] >> 4 != 4) {
+    return IP_CLASS_DROP_VERSION;
+  }
+  size_t ihl = 4 * (h[0] & 0xf);
+  if (ihl < 20 || (size_t)(h[2] << 8 | h[3]) < ihl) {
+    return IP_CLASS_DROP_HEADER_LENGTH;
+  }
+  if (!validateIPChecksum((uint8_t *)h, len)) {
+    return IP_CLASS_DROP_CHECKSUM;
+  }
+  bool local = (h[16] == 224 && h[17] == 0 && h[18] == 0) ||
+               (h[16] == 255 && h[17] == 255 && h[18] == 255 && h[19] == 255);
+  for (size_t i = 0; i < N_LOCAL; i++) {
+    if (memcmp(h + 16, &local_addrs[i], 4) == 0) {
+      local = true;
+    }
+  }
+  if (h[12] == 127 || h[12] >= 224 || (h[12] == 0 && !local)) {
+    return IP_CLASS_DROP_SOURCE;
+  }
+  if (!local && (h[16] == 0 || h[16] == 127 || h[16] >= 224)) {
+    return IP_CLASS_DROP_DESTINATION;
+  }
+  if (local && ((h[6] & 0x3f) || h[7])) {
+    return IP_CLASS_DROP_FRAGMENT;
+  }
+  if (!local && h[8] <= 1) {
+    return IP_CLASS_DROP_TTL;
+  }
+  if (ihl > 20) {
+    return IP_CLASS_SLOW;
+  }
+  return local ? IP_CLASS_LOCAL : IP_CLASS_FORWARD;
+}
+
+// a plain unicast packet to forward, broken in one or two random ways when bad is set
+static uint32_t randomPacket(uint8_t *packet, bool bad) {
+  randomHeader(packet, xorshift() % 16 == 0);
+  uint32_t len = 20 + xorshift() % 1480;
+  packet[0] = (packet[0] & 0xf) | 0x40;
+  packet[2] = (uint8_t)(len >> 8);
+  packet[3] = (uint8_t)len;
+  packet[6] &= 0x40;
+  packet[7] = 0;
+  packet[8] |= 2;
+  packet[12] = 1 + xorshift() % 126;
+  packet[16] = 1 + xorshift() % 126;
+  if (xorshift() % 16 == 0) {
+    memcpy(packet + 16, &local_addrs[xorshift() % N_LOCAL], 4);
+  }
+  for (uint32_t k = bad ? 1 + xorshift() % 2 : 0; k > 0; k--) {
+    switch (xorshift() % 9) {
+    case 0: len = xorshift() % 40; break;
+    case 1: packet[0] ^= 0x10 << xorshift() % 4; break;
+    case 2: packet[0] = (packet[0] & 0xf0) | xorshift() % 5; break;
+    case 3: packet[10] ^= 1 + xorshift() % 255; break;
+    case 4: packet[12] = xorshift() % 2 ? 127 : 224 + xorshift() % 32; break;
+    case 5: packet[16] = xorshift() % 2 ? 0 : 224 + xorshift() % 32; break;
+    case 6: packet[7] = 1 + xorshift() % 255; break;
+    case 7: packet[8] = xorshift() % 2; break;
+    default: memset(packet + 16, xorshift() % 2 ? 0xff : 0, 4); break;
+    }
+  }
+  // most of the breakage should get past the checksum
+  if (xorshift() % 4) {
+    ipChecksumFill(packet);
+  }
+  return len;
+}
+
+static bool checkClassify() {
+  vector<uint8_t> slots(N_SLOTS * SLOT_SIZE);
+  uint8_t *pkts[N_SLOTS];
+  uint32_t lens[N_SLOTS];
+  uint8_t verdicts[N_SLOTS];
+  uint32_t errors = 0, seen[IP_CLASS_COUNT] = {0};
+  for (uint32_t round = 0; round < N_CASES / N_SLOTS; round++) {
+    size_t n = xorshift() % (N_SLOTS + 1);
+    for (size_t i = 0; i < n; i++) {
+      pkts[i] = &slots[i * SLOT_SIZE];
+      lens[i] = randomPacket(pkts[i], xorshift() % 2);
+    }
+    size_t other = classifyIPv4Batch(pkts, lens, n, local_addrs, N_LOCAL, verdicts);
+    size_t expected_other = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint8_t expected = classifyBranchy(pkts[i], lens[i]);
+      expected_other += expected != IP_CLASS_FORWARD;
+      seen[expected]++;
+      if (verdicts[i] != expected && errors++ < 10) {
+        printf("classify: %u instead of %u\n", verdicts[i], expected);
+      }
+    }
+    if (other != expected_other && errors++ < 10) {
+      printf("classify: %zu not forwarded instead of %zu\n", other, expected_other);
+    }
+  }
+  printf("classify: %u batches, %u errors, verdicts", N_CASES / N_SLOTS, errors);
+  for (int i = 0; i < IP_CLASS_COUNT; i++) {
+    printf(" %u", seen[i]);
+  }
+  printf("\n");
+  return errors == 0 && seen[IP_CLASS_COUNT - 1] > 0;
+}
+
+// bursts of 32 packets, the share of malformed packets in percent
+static void benchClassify(uint32_t percent) {
+  vector<uint8_t> slots(N_SLOTS * SLOT_SIZE);
+  uint8_t *pkts[N_SLOTS];
+  uint32_t lens[N_SLOTS];
+  uint8_t verdicts[N_SLOTS];
+  for (uint32_t i = 0; i < N_SLOTS; i++) {
+    pkts[i] = &slots[i * SLOT_SIZE];
+    lens[i] = randomPacket(pkts[i], xorshift() % 100 < percent);
+  }
+  uint64_t sink = 0;
+  double ns[2];
+  for (int batch = 0; batch < 2; batch++) {
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < N_BATCH_ROUNDS; round++) {
+      for (size_t first = 0; first < N_SLOTS; first += 32) {
+        if (batch) {
+          sink += classifyIPv4Batch(pkts + first, lens + first, 32, local_addrs, N_LOCAL, verdicts + first);
+        } else {
+          for (size_t i = first; i < first + 32; i++) {
+            verdicts[i] = classifyBranchy(pkts[i], lens[i]);
+            sink += verdicts[i] != IP_CLASS_FORWARD;
+          }
+        }
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    ns[batch] = std::chrono::duration<double, std::nano>(end - begin).count() / N_BATCH_ROUNDS / N_SLOTS;
+  }
+  if (sink == 0 && percent > 0) {
+    printf("nothing dropped\n");
+  }
+  printf("%2u%% malformed: if after if %.2f ns/packet, classifyIPv4Batch %.2f ns/packet (%.2fx)\n", percent, ns[0],
+         ns[1], ns[0] / ns[1]);
+}
+
+static double headersPerNs(uint8_t **pkts, size_t n, bool batch) {
+  uint8_t bad_bits[N_SLOTS / 8];
+  uint64_t sink = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t round = 0; round < N_BATCH_ROUNDS; round++) {
+    if (batch) {
+      sink += validateIPChecksumBatch(pkts, n, bad_bits) + bad_bits[0];
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        sink += validateIPChecksum(pkts[i], 60);
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (sink == 0) {
+    printf("nothing checked\n");
+  }
+  return (double)N_BATCH_ROUNDS * n / std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+int main(int argc, char *argv[]) {
+  bool ok = check();
+  ok = checkIgmp() && ok;
+  ok = checkBatch() && ok;
+  ok = checkPayload() && ok;
+  ok = checkClassify() && ok;
+
+  for (int options = 0; options < 2; options++) {
+    vector<uint8_t> headers(N_HEADERS * 60);
+    for (uint32_t i = 0; i < N_HEADERS; i++) {
+      randomHeader(&headers[i * 60], options);
+    }
+    double validate_bytes = cyclesPerPacket(headers, [](uint8_t *h) { return validateBytewise(h, 60); });
+    double validate_words = cyclesPerPacket(headers, [](uint8_t *h) { return ipChecksumValid(h, 60); });
+    double forward_bytes = cyclesPerPacket(headers, [](uint8_t *h) { return forwardBytewise(h, 60); });
+    double forward_words =
+        cyclesPerPacket(headers, [](uint8_t *h) { return ipForwardHeader(h, 60) == IP_FORWARD_OK; });
+    printf("%s:\n", options ? "headers with options" : "20 byte headers");
+    printf("  validate, byte pairs   %6.1f cycles/packet\n", validate_bytes);
+    printf("  validate, ip_checksum  %6.1f cycles/packet (%.2fx)\n", validate_words, validate_bytes / validate_words);
+    printf("  forward,  byte pairs   %6.1f cycles/packet\n", forward_bytes);
+    printf("  forward,  ip_checksum  %6.1f cycles/packet (%.2fx)\n", forward_words, forward_bytes / forward_words);
+  }
+
+  // bursts of plain 20 byte headers in receive queue slots
+  vector<uint8_t> slots(N_SLOTS * SLOT_SIZE);
+  uint8_t *pkts[N_SLOTS];
+  for (uint32_t i = 0; i < N_SLOTS; i++) {
+    pkts[i] = &slots[i * SLOT_SIZE];
+    randomHeader(pkts[i], false);
+  }
+  for (size_t n = 8; n <= N_SLOTS; n *= 4) {
+    double single = headersPerNs(pkts, n, false);
+    double batch = headersPerNs(pkts, n, true);
+    printf("burst of %3zu: validateIPChecksum %.2f headers/ns, validateIPChecksumBatch %.2f headers/ns (%.2fx)\n", n,
+           single, batch, batch / single);
+  }
+
+  const uint32_t malformed[] = {0, 1, 10, 50};
+  for (uint32_t percent : malformed) {
+    benchClassify(percent);
+  }
+
+  // whole payloads: a RIP entry, a full RIP response, an Ethernet MTU, a jumbo frame
+  vector<uint8_t> payload(9000 + 32);
+  for (size_t k = 0; k < payload.size(); k++) {
+    payload[k] = xorshift();
+  }
+  const size_t lengths[] = {20, 512, 1500, 9000};
+  for (size_t len : lengths) {
+    double bytes = gigabytesPerSecond(&payload[0], len, [](const uint8_t *d, size_t n) {
+      return sumBytewise(d, n, 0) | 1;
+    });
+    double words = gigabytesPerSecond(&payload[0], len, [](const uint8_t *d, size_t n) {
+      return ipChecksumFold(ipChecksumAdd(d, n, 0)) | 1;
+    });
+    double wide = gigabytesPerSecond(&payload[0], len, [](const uint8_t *d, size_t n) {
+      return internetChecksum(d, n, 0) | 1;
+    });
+    printf("%4zu bytes: byte pairs %5.2f GB/s, ipChecksumAdd %5.2f GB/s, internetChecksum %5.2f GB/s (%.2fx)\n", len,
+           bytes, words, wide, wide / bytes);
+  }
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -1,3 +1,4 @@
+#include "ip_checksum.h"
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -12,36 +13,6 @@
  */
 bool forward(uint8_t *packet, size_t len)
 {
-  uint8_t length = 4 * (packet[0] & 0xf);
-  unsigned long checksum = 0;
-  unsigned short realchecksum = 0;
-  for (uint8_t i = 0; i < length; i += 2) {
-    if (i == 10) {
-      realchecksum = ((unsigned short)packet[i] << 8) + (unsigned short)packet[i + 1];
-    }
-    else {
-      checksum += (((unsigned long)packet[i] << 8) + (unsigned long)packet[i + 1]);
-    }
-  }
-  checksum = (checksum >> 16) + (checksum & 0xffff);
-  checksum += checksum >> 16;
-  if (realchecksum == ((unsigned short)~checksum)) {
-    packet[8] -= 1;
-    if(packet[8] == 0) {
-      return false;
-    }
-    checksum = 0;
-    for (uint8_t i = 0; i < length; i += 2) {
-      if (i != 10) {
-        checksum += (((unsigned long)packet[i] << 8) + (unsigned long)packet[i + 1]);
-      }
-    }
-    checksum = (checksum >> 16) + (checksum & 0xffff);
-    checksum += checksum >> 16;
-    packet[10] = (uint8_t)((~checksum) >> 8);
-    packet[11] = (uint8_t)~checksum;
-    return true;
-  } else {
-    return false;
-  }
+  // one pass over the header, the checksum is updated incrementally (RFC 1624)
+  return ipForwardHeader(packet, len) == IP_FORWARD_OK;
 }
@@ -0,0 +1,168 @@
+#include "fib.h"
+#include "router.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+using std::vector;
+
+// 评估 query() 前的缓存：在 pcap 抓包和 Zipf 分布的合成流量上统计命中率、
+// 每次查询的耗时，以及与直接查 FIB 相比节省的周期数
+// 用法: ./cache_eval [host0.pcap host1.pcap ...]
+
+extern void update(bool insert, RoutingTableEntry entry, uint32_t if_index);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+extern void queryCacheStats(uint64_t *hits, uint64_t *misses, uint64_t *cycles_saved);
+
+#define N_ROUTES 100000
+#define N_LOOKUPS 2000000
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static vector<RoutingTableEntry> routes;
+
+static void buildTable() {
+  // mostly /24 with a tail of shorter prefixes, roughly like a BGP table
+  for (uint32_t i = 0; i < N_ROUTES; i++) {
+    uint32_t r = xorshift() % 100;
+    uint32_t len = r < 60 ? 24 : r < 75 ? 22 + r % 2 : r < 90 ? 16 + r % 6 : 8 + r % 8;
+    uint32_t addr = xorshift() & ~(0xffffffffu >> len);
+    RoutingTableEntry entry = {htonl(addr), len, i % 4, htonl(xorshift()), htonl(1 + i % 15), false, NULL};
+    routes.push_back(entry);
+    update(true, entry, 0);
+  }
+  // the lab subnets seen in the captures
+  for (uint32_t i = 0; i < 8; i++) {
+    RoutingTableEntry entry = {htonl(0xc0a80000 | (i << 8)), 24, i % 4, 0, htonl(1), false, NULL};
+    update(true, entry, 0);
+  }
+}
+
+static uint32_t randomRoutedAddr() {
+  const RoutingTableEntry &route = routes[xorshift() % routes.size()];
+  uint32_t host = route.len == 32 ? 0 : xorshift() & (0xffffffffu >> route.len);
+  return route.addr | htonl(host);
+}
+
+static bool readPcap(const char *path, vector<uint32_t> &trace) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t header[6];
+  if (fread(header, sizeof(header), 1, fp) != 1 || header[0] != 0xa1b2c3d4 ||
+      header[5] != 1) {
+    // only little endian, ethernet captures
+    fclose(fp);
+    return false;
+  }
+  uint32_t record[4];
+  uint8_t packet[65536];
+  while (fread(record, sizeof(record), 1, fp) == 1) {
+    uint32_t caplen = record[2];
+    if (caplen > sizeof(packet) || fread(packet, 1, caplen, fp) != caplen) {
+      break;
+    }
+    if (caplen >= 34 && packet[12] == 0x08 && packet[13] == 0x00) {
+      uint32_t dst;
+      memcpy(&dst, &packet[30], sizeof(dst));
+      trace.push_back(dst);
+    }
+  }
+  fclose(fp);
+  return true;
+}
+
+static void zipfTrace(double s, uint32_t distinct, vector<uint32_t> &trace) {
+  vector<uint32_t> dsts(distinct);
+  vector<double> cdf(distinct);
+  double sum = 0;
+  for (uint32_t i = 0; i < distinct; i++) {
+    dsts[i] = randomRoutedAddr();
+    sum += 1.0 / pow(i + 1, s);
+    cdf[i] = sum;
+  }
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    double u = (double)xorshift() / 4294967296.0 * sum;
+    size_t rank = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    trace.push_back(dsts[std::min<size_t>(rank, distinct - 1)]);
+  }
+}
+
+static void evaluate(const char *name, const vector<uint32_t> &trace) {
+  uint64_t hits0, misses0, hits1, misses1, saved;
+  uint32_t nexthop, if_index, metric;
+  FibEntry entry;
+  volatile uint32_t sink = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t addr : trace) {
+    sink += fibLookup(addr, &entry);
+  }
+  auto middle = std::chrono::steady_clock::now();
+  queryCacheStats(&hits0, &misses0, &saved);
+  for (uint32_t addr : trace) {
+    sink += query(addr, &nexthop, &if_index, &metric);
+  }
+  auto end = std::chrono::steady_clock::now();
+  queryCacheStats(&hits1, &misses1, &saved);
+
+  double fib_ns = std::chrono::duration<double, std::nano>(middle - begin).count() / trace.size();
+  double query_ns = std::chrono::duration<double, std::nano>(end - middle).count() / trace.size();
+  uint64_t hits = hits1 - hits0;
+  uint64_t misses = misses1 - misses0;
+  printf("%-24s %9zu lookups  hit rate %6.2f%%  fib %7.1f ns  cached query %7.1f ns\n",
+         name, trace.size(), hits * 100.0 / (hits + misses), fib_ns, query_ns);
+}
+
+int main(int argc, char *argv[]) {
+  buildTable();
+
+  vector<uint32_t> captured;
+  for (int i = 1; i < argc; i++) {
+    if (!readPcap(argv[i], captured)) {
+      fprintf(stderr, "cannot read %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (!captured.empty()) {
+    vector<uint32_t> trace;
+    while (trace.size() < N_LOOKUPS) {
+      trace.insert(trace.end(), captured.begin(), captured.end());
+    }
+    evaluate("pcap", trace);
+  }
+
+  const double skews[] = {0.8, 1.0, 1.2};
+  for (double s : skews) {
+    vector<uint32_t> trace;
+    zipfTrace(s, 100000, trace);
+    char name[64];
+    sprintf(name, "zipf s=%.1f 100k dsts", s);
+    evaluate(name, trace);
+  }
+
+  vector<uint32_t> uniform;
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    uniform.push_back(randomRoutedAddr());
+  }
+  evaluate("uniform", uniform);
+
+  uint64_t hits, misses, saved;
+  queryCacheStats(&hits, &misses, &saved);
+  printf("total: %llu hits, %llu misses, about %llu cycles saved\n",
+         (unsigned long long)hits, (unsigned long long)misses,
+         (unsigned long long)saved);
+  return 0;
+}
@@ -0,0 +1,663 @@
+#include "fib.h"
+#include "router_hal.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+using std::vector;
+
+// fault the whole snapshot in up front where the platform can, lookups never wait on disk
+#ifdef MAP_POPULATE
+#define FIB_MAP_FLAGS (MAP_PRIVATE | MAP_POPULATE)
+#else
+#define FIB_MAP_FLAGS MAP_PRIVATE
+#endif
+
+// 同时在线的读者线程数上限，超出的线程退化为加锁查询
+#define FIB_MAX_READERS 64
+
+struct FibNode {
+  const FibNode *child[2];
+  FibEntry entry;
+  bool valid;
+};
+
+// one cache line per reader, so readers never write to a shared line
+struct alignas(64) ReaderSlot {
+  std::atomic<uint64_t> epoch; // 0 means outside of a lookup
+  std::atomic<bool> used;
+};
+
+// on-disk layout, children are indices into the node array and 0 means none
+struct FibSnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t node_count;
+  uint32_t checksum; // FNV-1a over the node array
+};
+
+struct FibSnapshotNode {
+  uint32_t child[2];
+  FibEntry entry;
+  uint32_t valid;
+};
+
+struct FibSnapshot {
+  const FibSnapshotNode *nodes;
+  uint32_t node_count;
+  void *map;
+  size_t map_len;
+};
+
+struct RetiredNodes {
+  uint64_t epoch;
+  vector<const FibNode *> nodes;
+  const FibSnapshot *snapshot;
+  void (*release)(void *ptr); // set for objects handed over by fibDefer()
+  void *ptr;
+};
+
+static std::atomic<const FibNode *> fib_root(nullptr);
+static std::atomic<const FibSnapshot *> fib_snapshot(nullptr);
+static std::atomic<uint64_t> fib_generation(1);
+static std::atomic<uint64_t> global_epoch(1);
+static ReaderSlot readers[FIB_MAX_READERS];
+
+// everything below is only touched with fib_writer held
+static std::mutex fib_writer;
+static vector<RetiredNodes> retired;
+// an open write batch, see fibBegin(); only the thread that opened it writes meanwhile
+static bool batch_open = false;
+static bool batch_dirty;
+static const FibNode *batch_root;
+static vector<const FibNode *> batch_garbage;
+static std::unordered_set<const FibNode *> batch_nodes; // unpublished copies, writable in place
+
+struct ReaderHandle {
+  int slot;
+  ReaderHandle() : slot(-1) {}
+  ~ReaderHandle() {
+    if (slot >= 0) {
+      readers[slot].used.store(false);
+    }
+  }
+};
+static thread_local ReaderHandle reader_handle;
+
+static int readerSlot() {
+  if (reader_handle.slot < 0) {
+    for (int i = 0; i < FIB_MAX_READERS; i++) {
+      bool expected = false;
+      if (readers[i].used.compare_exchange_strong(expected, true)) {
+        reader_handle.slot = i;
+        break;
+      }
+    }
+  }
+  return reader_handle.slot;
+}
+
+// enter a read-side critical section, threads without a slot take the writer lock
+static int readLock() {
+  int slot = readerSlot();
+  if (slot < 0) {
+    fib_writer.lock();
+  } else {
+    readers[slot].epoch.store(global_epoch.load());
+  }
+  return slot;
+}
+
+static void readUnlock(int slot) {
+  if (slot < 0) {
+    fib_writer.unlock();
+  } else {
+    readers[slot].epoch.store(0, std::memory_order_release);
+  }
+}
+
+// returns the length of the longest match, -1 if none
+// the length of the longest match, -1 when there is none or it is an entry without
+// paths: aggregation leaves those as an explicit "no route" that shadows shorter
+// prefixes of the same FIB, but never the other layer
+static int lookupIn(const FibNode *node, uint32_t key, FibEntry *entry) {
+  int matched = -1;
+  for (uint32_t depth = 0; node; depth++) {
+    if (node->valid) {
+      *entry = node->entry;
+      matched = depth;
+    }
+    if (depth == 32) {
+      break;
+    }
+    node = node->child[(key >> (31 - depth)) & 1];
+  }
+  return matched >= 0 && entry->paths > 0 ? matched : -1;
+}
+
+static int lookupSnapshot(const FibSnapshot *snapshot, uint32_t key,
+                          FibEntry *entry) {
+  int matched = -1;
+  uint32_t index = 0;
+  for (uint32_t depth = 0; index < snapshot->node_count; depth++) {
+    const FibSnapshotNode *node = &snapshot->nodes[index];
+    if (node->valid) {
+      *entry = node->entry;
+      matched = depth;
+    }
+    if (depth == 32) {
+      break;
+    }
+    index = node->child[(key >> (31 - depth)) & 1];
+    if (index == 0) {
+      break;
+    }
+  }
+  // like lookupIn()
+  return matched >= 0 && entry->paths > 0 ? matched : -1;
+}
+
+static uint32_t reclaimLocked() {
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < FIB_MAX_READERS; i++) {
+    uint64_t epoch = readers[i].epoch.load();
+    if (epoch != 0 && epoch < oldest) {
+      oldest = epoch;
+    }
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < retired.size(); i++) {
+    if (retired[i].epoch < oldest) {
+      for (auto node : retired[i].nodes) {
+        delete node;
+      }
+      if (retired[i].snapshot) {
+        munmap(retired[i].snapshot->map, retired[i].snapshot->map_len);
+        delete retired[i].snapshot;
+      }
+      if (retired[i].release) {
+        retired[i].release(retired[i].ptr);
+      }
+    } else {
+      retired[kept++] = std::move(retired[i]);
+    }
+  }
+  retired.resize(kept);
+  return kept;
+}
+
+// readers that entered at or before the returned epoch may still see garbage
+static void retire(vector<const FibNode *> &garbage,
+                   const FibSnapshot *snapshot) {
+  RetiredNodes batch;
+  batch.epoch = global_epoch.fetch_add(1);
+  batch.nodes.swap(garbage);
+  batch.snapshot = snapshot;
+  batch.release = nullptr;
+  batch.ptr = nullptr;
+  retired.push_back(std::move(batch));
+}
+
+static void publish(const FibNode *root, vector<const FibNode *> &garbage) {
+  fib_root.store(root);
+  fib_generation++;
+  if (!garbage.empty()) {
+    retire(garbage, nullptr);
+  }
+  reclaimLocked();
+}
+
+static FibNode *copyNode(const FibNode *node, vector<const FibNode *> &garbage) {
+  if (batch_open && node && batch_nodes.count(node)) {
+    return const_cast<FibNode *>(node);
+  }
+  FibNode *copy = new FibNode;
+  if (batch_open) {
+    batch_nodes.insert(copy);
+  }
+  if (node) {
+    *copy = *node;
+    garbage.push_back(node);
+  } else {
+    copy->child[0] = copy->child[1] = nullptr;
+    copy->valid = false;
+  }
+  return copy;
+}
+
+// the tree writes start from, unpublished while a batch is open
+static const FibNode *writerRoot() {
+  return batch_open ? batch_root : fib_root.load();
+}
+
+// publishes now, or leaves it to fibCommit() while a batch is open
+static void publishOrDefer(const FibNode *root, vector<const FibNode *> &garbage) {
+  if (!batch_open) {
+    publish(root, garbage);
+    return;
+  }
+  batch_root = root;
+  batch_dirty = true;
+  batch_garbage.insert(batch_garbage.end(), garbage.begin(), garbage.end());
+}
+
+void fibInsert(uint32_t addr, uint32_t len, const FibEntry *entry) {
+  std::unique_lock<std::mutex> lock(fib_writer, std::defer_lock);
+  if (!batch_open) {
+    lock.lock();
+  }
+  uint32_t key = ntohl(addr);
+  vector<const FibNode *> garbage;
+  FibNode *root = copyNode(writerRoot(), garbage);
+  FibNode *node = root;
+  for (uint32_t depth = 0; depth < len; depth++) {
+    int bit = (key >> (31 - depth)) & 1;
+    FibNode *child = copyNode(node->child[bit], garbage);
+    node->child[bit] = child;
+    node = child;
+  }
+  node->entry = *entry;
+  node->valid = true;
+  publishOrDefer(root, garbage);
+}
+
+void fibRemove(uint32_t addr, uint32_t len) {
+  std::unique_lock<std::mutex> lock(fib_writer, std::defer_lock);
+  if (!batch_open) {
+    lock.lock();
+  }
+  uint32_t key = ntohl(addr);
+  const FibNode *old = writerRoot();
+  for (uint32_t depth = 0; old && depth < len; depth++) {
+    old = old->child[(key >> (31 - depth)) & 1];
+  }
+  if (!old || !old->valid) {
+    return;
+  }
+
+  vector<const FibNode *> garbage;
+  FibNode *path[33];
+  path[0] = copyNode(writerRoot(), garbage);
+  for (uint32_t depth = 0; depth < len; depth++) {
+    int bit = (key >> (31 - depth)) & 1;
+    path[depth + 1] = copyNode(path[depth]->child[bit], garbage);
+    path[depth]->child[bit] = path[depth + 1];
+  }
+  path[len]->valid = false;
+  // prune the now empty tail of the path, the copies were never published
+  int depth = len;
+  while (depth >= 0 && !path[depth]->valid && !path[depth]->child[0] &&
+         !path[depth]->child[1]) {
+    batch_nodes.erase(path[depth]);
+    delete path[depth];
+    if (depth > 0) {
+      path[depth - 1]->child[(key >> (32 - depth)) & 1] = nullptr;
+    }
+    depth--;
+  }
+  publishOrDefer(depth >= 0 ? path[0] : nullptr, garbage);
+}
+
+void fibBegin() {
+  fib_writer.lock();
+  batch_open = true;
+  batch_dirty = false;
+  batch_root = fib_root.load();
+}
+
+void fibCommit() {
+  if (batch_dirty) {
+    publish(batch_root, batch_garbage);
+  }
+  batch_garbage.clear();
+  batch_nodes.clear();
+  batch_open = false;
+  fib_writer.unlock();
+}
+
+bool fibInBatch() { return batch_open; }
+
+static std::atomic<uint32_t> build_threads(0);
+
+void fibSetBuildThreads(uint32_t threads) { build_threads = threads; }
+
+void fibParallelFor(size_t count, void (*task)(void *arg, size_t index), void *arg) {
+  size_t threads = build_threads.load();
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, count);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < count;) {
+      task(arg, i);
+    }
+  };
+  vector<std::thread> workers;
+  for (size_t i = 1; i < threads; i++) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (auto &t : workers) {
+    t.join();
+  }
+}
+
+struct BuildTask {
+  const FibRoute *routes;
+  size_t count;
+  const FibNode **slot;
+};
+
+// routes all share their first depth bits and are sorted, so they are in trie preorder;
+// with defer set, non-empty subtrees at depth FIB_BUILD_SPLIT are left to the caller
+static const FibNode *buildTrie(const FibRoute *routes, size_t count,
+                                uint32_t depth, vector<BuildTask> *defer) {
+  if (count == 0) {
+    return nullptr;
+  }
+  FibNode *node = new FibNode;
+  node->child[0] = node->child[1] = nullptr;
+  node->valid = false;
+  size_t first = 0;
+  if (routes[0].len == depth) {
+    node->entry = routes[0].entry;
+    node->valid = true;
+    first = 1;
+  }
+  if (depth == 32) {
+    return node;
+  }
+  size_t split = first;
+  while (split < count && !((ntohl(routes[split].addr) >> (31 - depth)) & 1)) {
+    split++;
+  }
+  const FibRoute *range[2] = {routes + first, routes + split};
+  size_t size[2] = {split - first, count - split};
+  for (int bit = 0; bit < 2; bit++) {
+    if (defer && depth + 1 == FIB_BUILD_SPLIT && size[bit]) {
+      BuildTask task = {range[bit], size[bit], &node->child[bit]};
+      defer->push_back(task);
+    } else {
+      node->child[bit] = buildTrie(range[bit], size[bit], depth + 1, defer);
+    }
+  }
+  return node;
+}
+
+static void buildTask(void *arg, size_t index) {
+  BuildTask &task = (*(vector<BuildTask> *)arg)[index];
+  *task.slot = buildTrie(task.routes, task.count, FIB_BUILD_SPLIT, nullptr);
+}
+
+void fibReplace(const FibRoute *routes, size_t count) {
+  vector<BuildTask> tasks;
+  const FibNode *root = buildTrie(routes, count, 0, &tasks);
+  fibParallelFor(tasks.size(), buildTask, &tasks);
+  std::lock_guard<std::mutex> lock(fib_writer);
+  vector<const FibNode *> garbage;
+  vector<const FibNode *> stack;
+  if (fib_root.load()) {
+    stack.push_back(fib_root.load());
+  }
+  while (!stack.empty()) {
+    const FibNode *node = stack.back();
+    stack.pop_back();
+    garbage.push_back(node);
+    for (int bit = 0; bit < 2; bit++) {
+      if (node->child[bit]) {
+        stack.push_back(node->child[bit]);
+      }
+    }
+  }
+  publish(root, garbage);
+}
+
+bool fibLookup(uint32_t addr, FibEntry *entry) {
+  uint32_t key = ntohl(addr);
+  int slot = readLock();
+  int matched = lookupIn(fib_root.load(), key, entry);
+  const FibSnapshot *snapshot = fib_snapshot.load();
+  if (snapshot) {
+    FibEntry warm;
+    int warm_matched = lookupSnapshot(snapshot, key, &warm);
+    if (warm_matched > matched) {
+      *entry = warm;
+      matched = warm_matched;
+    }
+  }
+  readUnlock(slot);
+  return matched >= 0;
+}
+
+uint64_t fibGeneration() { return fib_generation.load(); }
+
+size_t fibMemory() {
+  size_t nodes = 0;
+  int slot = readLock();
+  vector<const FibNode *> stack;
+  if (fib_root.load()) {
+    stack.push_back(fib_root.load());
+  }
+  while (!stack.empty()) {
+    const FibNode *node = stack.back();
+    stack.pop_back();
+    nodes++;
+    for (int bit = 0; bit < 2; bit++) {
+      if (node->child[bit]) {
+        stack.push_back(node->child[bit]);
+      }
+    }
+  }
+  readUnlock(slot);
+  return nodes * sizeof(FibNode);
+}
+
+int fibReadLock() { return readLock(); }
+
+void fibReadUnlock(int slot) { readUnlock(slot); }
+
+void fibDefer(void (*release)(void *ptr), void *ptr) {
+  std::lock_guard<std::mutex> lock(fib_writer);
+  RetiredNodes batch;
+  batch.epoch = global_epoch.fetch_add(1);
+  batch.snapshot = nullptr;
+  batch.release = release;
+  batch.ptr = ptr;
+  retired.push_back(std::move(batch));
+  reclaimLocked();
+}
+
+uint32_t fibReclaim() {
+  std::lock_guard<std::mutex> lock(fib_writer);
+  return reclaimLocked();
+}
+
+static uint32_t snapshotChecksum(const FibSnapshotNode *nodes, uint32_t count) {
+  const uint32_t *words = (const uint32_t *)nodes;
+  size_t n = (size_t)count * sizeof(FibSnapshotNode) / sizeof(uint32_t);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    hash = (hash ^ words[i]) * 16777619u;
+  }
+  return hash;
+}
+
+bool fibSaveSnapshot(const char *path) {
+  struct Pending {
+    const FibNode *node;
+    uint32_t parent;
+    int bit;
+  };
+  // preorder numbering, so every child index is larger than its parent's
+  vector<FibSnapshotNode> nodes;
+  vector<Pending> stack;
+  int slot = readLock();
+  const FibNode *root = fib_root.load();
+  if (root) {
+    Pending first = {root, 0, -1};
+    stack.push_back(first);
+  }
+  while (!stack.empty()) {
+    Pending top = stack.back();
+    stack.pop_back();
+    uint32_t index = nodes.size();
+    if (top.bit >= 0) {
+      nodes[top.parent].child[top.bit] = index;
+    }
+    // entries of invalid nodes are left over garbage, keep the file deterministic
+    FibSnapshotNode out = {{0, 0}, {0, 0, {0}, {0}}, top.node->valid};
+    if (top.node->valid) {
+      out.entry = top.node->entry;
+    }
+    nodes.push_back(out);
+    for (int bit = 1; bit >= 0; bit--) {
+      if (top.node->child[bit]) {
+        Pending child = {top.node->child[bit], index, bit};
+        stack.push_back(child);
+      }
+    }
+  }
+  readUnlock(slot);
+
+  FibSnapshotHeader header = {FIB_SNAPSHOT_MAGIC, FIB_SNAPSHOT_VERSION,
+                              (uint32_t)nodes.size(), 0};
+  header.checksum = snapshotChecksum(nodes.data(), nodes.size());
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(nodes.data(), sizeof(FibSnapshotNode), nodes.size(), fp) ==
+                nodes.size() &&
+            fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool fibLoadSnapshot(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FibSnapshotHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t map_len = st.st_size;
+  void *map = mmap(NULL, map_len, PROT_READ, FIB_MAP_FLAGS, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+#ifndef MAP_POPULATE
+  madvise(map, map_len, MADV_WILLNEED);
+#endif
+
+  const FibSnapshotHeader *header = (const FibSnapshotHeader *)map;
+  const FibSnapshotNode *nodes = (const FibSnapshotNode *)(header + 1);
+  uint32_t count = header->node_count;
+  bool ok = header->magic == FIB_SNAPSHOT_MAGIC &&
+            header->version == FIB_SNAPSHOT_VERSION &&
+            map_len == sizeof(FibSnapshotHeader) +
+                           (size_t)count * sizeof(FibSnapshotNode) &&
+            snapshotChecksum(nodes, count) == header->checksum;
+  // lookups index nexthop[] and if_index[] with what the file says, check it all up front
+  for (uint32_t i = 0; ok && i < count; i++) {
+    for (int bit = 0; bit < 2; bit++) {
+      uint32_t child = nodes[i].child[bit];
+      if (child != 0 && (child <= i || child >= count)) {
+        ok = false;
+      }
+    }
+    const FibEntry *entry = &nodes[i].entry;
+    if (nodes[i].valid && entry->paths > FIB_MAX_PATHS) {
+      ok = false;
+    }
+    for (uint32_t j = 0; ok && nodes[i].valid && j < entry->paths; j++) {
+      if (entry->if_index[j] >= N_IFACE_ON_BOARD) {
+        ok = false;
+      }
+    }
+  }
+  if (!ok) {
+    munmap(map, map_len);
+    return false;
+  }
+
+  FibSnapshot *snapshot = new FibSnapshot;
+  snapshot->nodes = nodes;
+  snapshot->node_count = count;
+  snapshot->map = map;
+  snapshot->map_len = map_len;
+  std::lock_guard<std::mutex> lock(fib_writer);
+  const FibSnapshot *old = fib_snapshot.exchange(snapshot);
+  fib_generation++;
+  if (old) {
+    vector<const FibNode *> none;
+    retire(none, old);
+  }
+  return true;
+}
+
+void fibDropSnapshot() {
+  std::lock_guard<std::mutex> lock(fib_writer);
+  const FibSnapshot *old = fib_snapshot.exchange(nullptr);
+  if (old) {
+    fib_generation++;
+    vector<const FibNode *> none;
+    retire(none, old);
+    reclaimLocked();
+  }
+}
+
+static std::thread snapshot_writer;
+static std::atomic<bool> snapshot_writer_running(false);
+
+static void snapshotWriterLoop(std::string path, uint32_t interval_ms) {
+  uint64_t saved = UINT64_MAX;
+  while (snapshot_writer_running.load()) {
+    for (uint32_t waited = 0; waited < interval_ms && snapshot_writer_running.load();
+         waited += 50) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    uint64_t generation = fib_generation.load();
+    // never overwrite the snapshot we are still warm starting from
+    if (generation != saved && !fib_snapshot.load()) {
+      if (fibSaveSnapshot(path.c_str())) {
+        saved = generation;
+      }
+    }
+  }
+}
+
+void fibStartSnapshotWriter(const char *path, uint32_t interval_ms) {
+  if (snapshot_writer_running.exchange(true)) {
+    return;
+  }
+  snapshot_writer = std::thread(snapshotWriterLoop, std::string(path), interval_ms);
+}
+
+void fibStopSnapshotWriter() {
+  if (snapshot_writer_running.exchange(false)) {
+    snapshot_writer.join();
+  }
+}
@@ -0,0 +1,189 @@
+#ifndef __FIB_H__
+#define __FIB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 一个前缀最多的等价路径（ECMP）数
+#define FIB_MAX_PATHS 4
+
+// 转发表（FIB）中一个前缀对应的转发信息，是一组 metric 相同的等价路径
+typedef struct {
+  uint32_t metric;                   // 大端序
+  uint32_t paths;                    // 有效路径数，[0, FIB_MAX_PATHS]，0 表示无路由
+  uint32_t nexthop[FIB_MAX_PATHS];   // 大端序，0 表示直连
+  uint32_t if_index[FIB_MAX_PATHS];  // 小端序
+} FibEntry;
+
+/*
+  FIB 是一棵按位展开的二叉前缀树，节点一经发布就不再修改。
+  写者沿路径复制节点，再用一次原子指针交换发布新的根；
+  读者不加锁，旧节点在所有读者都离开旧 epoch 后才释放。
+  写操作之间由内部的互斥锁串行化。
+*/
+
+/**
+ * @brief 插入或替换一个前缀
+ * @param addr 前缀地址，大端序
+ * @param len 前缀长度
+ * @param entry 转发信息
+ */
+void fibInsert(uint32_t addr, uint32_t len, const FibEntry *entry);
+
+// 批量构建 FIB 时的一个前缀
+typedef struct {
+  uint32_t addr; // 大端序
+  uint32_t len;
+  FibEntry entry;
+} FibRoute;
+
+/*
+  批量构建（fibReplace() 和 ortcLoad()）按地址最高的 FIB_BUILD_SPLIT 位把树拆成
+  互不相交的子树，在多个线程上并行构建，再接回上面几层；结果与单线程构建完全相同。
+*/
+#define FIB_BUILD_SPLIT 6
+
+/**
+ * @brief 自底向上一次性构建新的 FIB ，再用一次原子交换替换掉当前的整个 FIB
+ * @param routes 前缀数组，按地址（按小端序比较）和前缀长度升序排列，没有重复
+ * @param count 前缀个数
+ */
+void fibReplace(const FibRoute *routes, size_t count);
+
+/**
+ * @brief 设置批量构建使用的线程数
+ * @param threads 线程数，0 表示使用全部 CPU 核（默认）
+ */
+void fibSetBuildThreads(uint32_t threads);
+
+/**
+ * @brief 在批量构建的线程上执行 task(arg, 0) 到 task(arg, count - 1)，全部完成后返回
+ * @param count 任务个数
+ * @param task 任务函数，不同的 index 可能在不同线程上同时执行
+ * @param arg 传给 task 的参数
+ */
+void fibParallelFor(size_t count, void (*task)(void *arg, size_t index), void *arg);
+
+/**
+ * @brief 开始一批写操作：之后的 fibInsert() 和 fibRemove() 只修改还没有发布的副本，
+ *        fibCommit() 时才用一次原子交换发布，读者看不到中间状态，版本号也只加一
+ *
+ * 一批之内同一个节点只复制一次。批处理期间其他线程不能写 FIB 。
+ */
+void fibBegin();
+
+/**
+ * @brief 发布 fibBegin() 之后的所有修改，没有修改时不发布
+ */
+void fibCommit();
+
+/**
+ * @brief 写者线程判断自己是否已经在 fibBegin() 和 fibCommit() 之间，
+ *        用来决定要不要自己开一批
+ * @return 有一批没有提交时返回 true
+ */
+bool fibInBatch();
+
+/**
+ * @brief 删除一个前缀，不存在时什么也不做
+ * @param addr 前缀地址，大端序
+ * @param len 前缀长度
+ */
+void fibRemove(uint32_t addr, uint32_t len);
+
+/**
+ * @brief 最长前缀匹配，可以在任意线程中无锁调用
+ * @param addr 目标地址，大端序
+ * @param entry 查到时写入匹配表项的转发信息
+ * @return 查到则返回 true ，没查到或者匹配到没有路径的表项则返回 false
+ */
+bool fibLookup(uint32_t addr, FibEntry *entry);
+
+/**
+ * @brief FIB 的版本号，每次发布新的 FIB 或者加载、撤下快照后加一，
+ *        查询结果的缓存可以用它在 O(1) 时间内整体失效
+ * @return 当前版本号
+ */
+uint64_t fibGeneration();
+
+/**
+ * @brief 回收已经没有读者引用的旧节点，写者在每次发布后会自动调用
+ * @return 仍在等待回收的旧版本个数
+ */
+uint32_t fibReclaim();
+
+/**
+ * @brief 当前 FIB 的节点占用的内存（不含快照），需要遍历整棵树
+ * @return 字节数
+ */
+size_t fibMemory();
+
+/*
+  其他无锁的查询结构（见 range.h）也可以借用 FIB 的 epoch 机制：
+  查询前后调用 fibReadLock() / fibReadUnlock() ，替换下来的旧结构交给 fibDefer() ，
+  等所有可能还在读它的读者离开后再释放。
+*/
+
+/**
+ * @brief 进入读侧临界区
+ * @return 传给 fibReadUnlock() 的值
+ */
+int fibReadLock();
+
+/**
+ * @brief 离开读侧临界区
+ * @param slot fibReadLock() 的返回值
+ */
+void fibReadUnlock(int slot);
+
+/**
+ * @brief 推迟释放一个已经不再可见的对象，不能在读侧临界区中调用
+ * @param release 释放函数，会以 ptr 为参数在某个写者线程中调用
+ * @param ptr 要释放的对象
+ */
+void fibDefer(void (*release)(void *ptr), void *ptr);
+
+/*
+  FIB 快照用于热重启：把 FIB 序列化成与地址无关的二进制文件（节点之间用下标引用），
+  文件头带有版本号和校验和，启动时直接只读 mmap 进来就能查询。
+  快照作为一层只读的 FIB 叠在当前 FIB 下面，两者取最长匹配，前缀长度相同时以当前 FIB 为准。
+  paths 为 0 的表项只在自己那一层表示“无路由”，合并时这一层按没查到处理，不会遮住另一层的路由。
+*/
+
+#define FIB_SNAPSHOT_MAGIC 0x42494652 // "RFIB"
+#define FIB_SNAPSHOT_VERSION 2
+
+/**
+ * @brief 把当前 FIB 写入快照文件，先写临时文件再 rename ，不会留下写了一半的快照
+ * @param path 快照文件路径
+ * @return 成功返回 true
+ */
+bool fibSaveSnapshot(const char *path);
+
+/**
+ * @brief 只读 mmap 一个快照文件，校验通过后立即参与查询
+ * @param path 快照文件路径
+ * @return 文件不存在、版本不符、校验和错误，或者表项的 paths 超过 FIB_MAX_PATHS 、
+ * 出端口不小于 N_IFACE_ON_BOARD 时返回 false
+ */
+bool fibLoadSnapshot(const char *path);
+
+/**
+ * @brief 撤下已加载的快照，映射在所有读者离开后才会 munmap
+ */
+void fibDropSnapshot();
+
+/**
+ * @brief 启动后台线程，FIB 有变化时每隔 interval_ms 毫秒刷新一次快照文件；
+ *        已加载的快照还在使用时不会覆盖它
+ * @param path 快照文件路径
+ * @param interval_ms 刷新间隔，单位为毫秒
+ */
+void fibStartSnapshotWriter(const char *path, uint32_t interval_ms);
+
+/**
+ * @brief 停止后台刷新线程
+ */
+void fibStopSnapshotWriter();
+
+#endif
@@ -0,0 +1,130 @@
+#include "fib.h"
+#include "ortc.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using std::vector;
+
+// 并行重建 FIB 的测试：同一张表分别用 1 、 2 、 4 ……个线程完整重建
+// （ortcLoad() 的两遍 ORTC 加上 fibReplace() 建树），记录耗时，
+// 并把每次得到的 FIB 写成快照，逐字节与单线程重建的结果比较；
+// 单线程重建的结果再与逐条 ortcUpdate() 增量建出的 FIB 比较
+
+#define SNAPSHOT_FILE "fib_build.snapshot"
+#define N_NEIGHBOURS 8
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static vector<FibRoute> makeTable(uint32_t n) {
+  vector<FibRoute> routes;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t r = xorshift() % 100;
+    uint32_t len = r < 55 ? 24 : r < 70 ? 22 + r % 2 : r < 88 ? 16 + r % 6 : 8 + r % 8;
+    uint32_t addr = xorshift() & ~(0xffffffffu >> len);
+    uint32_t hop = xorshift() % N_NEIGHBOURS;
+    FibRoute route = {htonl(addr), len, {htonl(1), 1, {htonl(0x0a000001 + hop)}, {hop % 4}}};
+    routes.push_back(route);
+  }
+  return routes;
+}
+
+static bool readFile(const char *path, vector<uint8_t> &data) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint8_t buffer[65536];
+  size_t n;
+  data.clear();
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(fp);
+  return true;
+}
+
+static bool saveFib(vector<uint8_t> &data) {
+  if (!fibSaveSnapshot(SNAPSHOT_FILE) || !readFile(SNAPSHOT_FILE, data)) {
+    printf("cannot write %s\n", SNAPSHOT_FILE);
+    return false;
+  }
+  return true;
+}
+
+static bool evaluate(uint32_t n) {
+  vector<FibRoute> routes = makeTable(n);
+  vector<uint8_t> incremental, serial, parallel;
+
+  // the first load creates the aggregation trie; on small tables also build it
+  // route by route through fibInsert()/fibRemove() as an independent reference
+  auto begin = std::chrono::steady_clock::now();
+  if (n <= 100000) {
+    for (const FibRoute &route : routes) {
+      ortcUpdate(route.addr, route.len, &route.entry);
+    }
+    if (!saveFib(incremental)) {
+      return false;
+    }
+  } else {
+    ortcLoad(routes.data(), routes.size());
+  }
+  auto end = std::chrono::steady_clock::now();
+  printf("%8u routes: initial %s load %8.1f ms\n", n, n <= 100000 ? "incremental" : "bulk",
+         std::chrono::duration<double, std::milli>(end - begin).count());
+
+  vector<uint32_t> thread_counts = {1, 2, 4};
+  uint32_t cores = std::thread::hardware_concurrency();
+  if (cores > 4) {
+    thread_counts.push_back(cores);
+  }
+  bool ok = true;
+  double serial_ms = 0;
+  for (uint32_t threads : thread_counts) {
+    fibSetBuildThreads(threads);
+    // loading the same table again makes ortcLoad() redo both passes and the FIB from scratch
+    begin = std::chrono::steady_clock::now();
+    ortcLoad(routes.data(), routes.size());
+    end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    if (!saveFib(threads == 1 ? serial : parallel)) {
+      return false;
+    }
+    bool same = threads == 1 ? incremental.empty() || serial == incremental : parallel == serial;
+    if (threads == 1) {
+      serial_ms = ms;
+    }
+    uint32_t rib_prefixes, fib_prefixes;
+    ortcStats(&rib_prefixes, &fib_prefixes);
+    printf("%8u routes, %2u threads: rebuild %8.1f ms (%.2fx), fib %7u prefixes, %s\n", n,
+           threads, ms, serial_ms / ms, fib_prefixes,
+           same ? "identical" : threads == 1 ? "DIFFERENT from incremental" : "DIFFERENT from serial");
+    ok &= same;
+  }
+  fibSetBuildThreads(0);
+
+  for (const FibRoute &route : routes) {
+    ortcUpdate(route.addr, route.len, NULL);
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  const uint32_t sizes[] = {1000, 100000, 1000000};
+  bool ok = true;
+  for (uint32_t n : sizes) {
+    ok &= evaluate(n);
+  }
+  unlink(SNAPSHOT_FILE);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include "fib.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+using std::vector;
+
+// 8 个读者线程不停查询，同时 1 个写者线程不断增删路由，一半的修改在 fibBegin() 和 fibCommit() 之间成批发布
+// 比较有无写者时读者的吞吐量，并检查不受写者影响的路由始终能查到正确结果
+
+#define N_READERS 8
+#define N_STABLE 4096
+#define N_CHURN 65536
+#define RUN_MS 1000
+
+static std::atomic<bool> running;
+static std::atomic<bool> writing;
+static std::atomic<uint64_t> lookups;
+static std::atomic<uint64_t> errors;
+
+static FibEntry singlePath(uint32_t nexthop, uint32_t if_index, uint32_t metric) {
+  FibEntry entry = {metric, 1, {nexthop}, {if_index}};
+  return entry;
+}
+
+static uint32_t xorshift(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// stable routes live in 10.0.0.0/8 with /20 prefixes, churned routes never touch 10/8
+static uint32_t stableAddr(uint32_t i) { return htonl(0x0a000000 | (i << 12)); }
+
+static uint32_t churnAddr(uint32_t &state, uint32_t *len) {
+  *len = 16 + xorshift(state) % 17;
+  uint32_t addr;
+  do {
+    addr = xorshift(state);
+  } while ((addr >> 24) == 0x0a);
+  addr &= *len == 32 ? 0xffffffff : ~(0xffffffffu >> *len);
+  return htonl(addr);
+}
+
+static void reader(uint32_t seed) {
+  uint32_t state = seed;
+  uint64_t count = 0;
+  FibEntry entry;
+  while (running.load(std::memory_order_relaxed)) {
+    for (int i = 0; i < 256; i++) {
+      uint32_t r = xorshift(state);
+      if (r & 1) {
+        uint32_t index = (r >> 1) % N_STABLE;
+        uint32_t addr = stableAddr(index) | htonl(r >> 21);
+        if (!fibLookup(addr, &entry) || entry.if_index[0] != index % 4 ||
+            entry.nexthop[0] != stableAddr(index)) {
+          errors++;
+        }
+      } else {
+        fibLookup(r, &entry);
+      }
+    }
+    count += 256;
+  }
+  lookups += count;
+}
+
+static void writer() {
+  uint32_t state = 0x12345678;
+  uint64_t count = 0;
+  while (writing.load(std::memory_order_relaxed)) {
+    // every other group of 25 updates is one batch, like a RIP response
+    bool batch = (count / 25) & 1;
+    if (batch) {
+      fibBegin();
+    }
+    for (int i = 0; i < 25; i++) {
+      uint32_t len;
+      uint32_t addr = churnAddr(state, &len);
+      if (xorshift(state) & 1) {
+        FibEntry entry = singlePath(addr, len % 4, htonl(len));
+        fibInsert(addr, len, &entry);
+      } else {
+        fibRemove(addr, len);
+      }
+      count++;
+    }
+    if (batch) {
+      fibCommit();
+    }
+  }
+  printf("writer: %llu updates\n", (unsigned long long)count);
+}
+
+static double runReaders(bool withWriter) {
+  running = true;
+  writing = withWriter;
+  lookups = 0;
+  vector<std::thread> threads;
+  for (int i = 0; i < N_READERS; i++) {
+    threads.push_back(std::thread(reader, 0x9e3779b9u * (i + 1)));
+  }
+  std::thread w;
+  if (withWriter) {
+    w = std::thread(writer);
+  }
+  auto begin = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(RUN_MS));
+  running = false;
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  writing = false;
+  if (withWriter) {
+    w.join();
+  }
+  double seconds = std::chrono::duration<double>(end - begin).count();
+  return lookups.load() / seconds;
+}
+
+int main(int argc, char *argv[]) {
+  for (uint32_t i = 0; i < N_STABLE; i++) {
+    FibEntry entry = singlePath(stableAddr(i), i % 4, htonl(1));
+    fibInsert(stableAddr(i), 20, &entry);
+  }
+  uint32_t state = 0xdeadbeef;
+  for (uint32_t i = 0; i < N_CHURN; i++) {
+    uint32_t len;
+    uint32_t addr = churnAddr(state, &len);
+    FibEntry entry = singlePath(addr, len % 4, htonl(len));
+    fibInsert(addr, len, &entry);
+  }
+
+  double idle = runReaders(false);
+  double busy = runReaders(true);
+  printf("readers without writer: %.2f Mlookups/s\n", idle / 1e6);
+  printf("readers with writer:    %.2f Mlookups/s (%.1f%%)\n", busy / 1e6,
+         busy * 100 / idle);
+  printf("pending retired versions: %u\n", fibReclaim());
+  if (errors.load()) {
+    printf("FAILED: %llu wrong lookups\n", (unsigned long long)errors.load());
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
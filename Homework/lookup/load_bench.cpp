@@ -0,0 +1,169 @@
+#include "fib.h"
+#include "router.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+using std::vector;
+
+// 比较导入整张路由表到可以查询（time-to-ready）的耗时：
+// 逐行解析 main.cpp 的 I 命令并调用 update()，与 loadRoutes() / loadRouteFile() 批量导入。
+// 每次测量都在一个新的子进程中进行，路由表从空开始。逐条导入是平方复杂度，
+// 只测到较小的规模，再按平方外推到 1M 。
+
+extern void update(bool insert, RoutingTableEntry entry, uint32_t if_index);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+extern void loadRoutes(const RoutingTableEntry *entries, size_t count);
+extern bool loadRouteFile(const char *path);
+extern bool saveRouteFile(const char *path);
+
+#define ROUTE_FILE "load_bench.routes"
+#define N_CHECKS 200000
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static vector<RoutingTableEntry> makeTable(uint32_t n) {
+  vector<RoutingTableEntry> entries;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t r = xorshift() % 100;
+    uint32_t len = r < 55 ? 24 : r < 70 ? 22 + r % 2 : r < 88 ? 16 + r % 6 : 8 + r % 8;
+    uint32_t addr = xorshift() & ~(0xffffffffu >> len);
+    RoutingTableEntry entry = {htonl(addr), len, i % 4, htonl(0x0a000001 + i % 8), htonl(1), false, NULL};
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+static vector<std::string> makeCommands(const vector<RoutingTableEntry> &entries) {
+  vector<std::string> lines;
+  char line[64];
+  for (const RoutingTableEntry &entry : entries) {
+    sprintf(line, "I,%x,%d,%d,%x\n", entry.addr, entry.len, entry.if_index, entry.nexthop);
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// the same parsing and update() call as main.cpp
+static void runCommands(const vector<std::string> &lines) {
+  uint32_t addr, len, if_index, nexthop;
+  char tmp;
+  for (const std::string &line : lines) {
+    sscanf(line.c_str(), "%c,%x,%d,%d,%x", &tmp, &addr, &len, &if_index, &nexthop);
+    RoutingTableEntry entry = {addr, len, if_index, nexthop, htonl(1), false, NULL};
+    update(true, entry, 0);
+  }
+}
+
+static uint64_t checksum() {
+  uint32_t state = 0x12345678, nexthop, if_index, metric;
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < N_CHECKS; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    if (query(state, &nexthop, &if_index, &metric)) {
+      sum = sum * 31 + nexthop + if_index;
+    } else {
+      sum = sum * 31 + 1;
+    }
+  }
+  return sum;
+}
+
+enum Mode { COMMANDS, BULK, FILE_LOAD };
+
+// runs one load in a fresh child process, returns seconds and the lookup checksum
+static double measure(Mode mode, const vector<RoutingTableEntry> &entries,
+                      const vector<std::string> &lines, uint64_t *sum) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    exit(1);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    auto begin = std::chrono::steady_clock::now();
+    if (mode == COMMANDS) {
+      runCommands(lines);
+    } else if (mode == BULK) {
+      loadRoutes(entries.data(), entries.size());
+    } else if (!loadRouteFile(ROUTE_FILE)) {
+      _exit(1);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double result[2] = {std::chrono::duration<double>(end - begin).count(), 0};
+    uint64_t s = checksum();
+    memcpy(&result[1], &s, sizeof(s));
+    ssize_t written = write(fds[1], result, sizeof(result));
+    _exit(written == sizeof(result) ? 0 : 1);
+  }
+  close(fds[1]);
+  double result[2] = {-1, 0};
+  if (read(fds[0], result, sizeof(result)) != sizeof(result)) {
+    result[0] = -1;
+  }
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+  memcpy(sum, &result[1], sizeof(*sum));
+  return result[0];
+}
+
+int main(int argc, char *argv[]) {
+  bool failed = false;
+  const uint32_t command_sizes[] = {10000, 20000, 40000};
+  double per_route_squared = 0;
+  for (uint32_t n : command_sizes) {
+    rng = 2463534242u;
+    vector<RoutingTableEntry> entries = makeTable(n);
+    vector<std::string> lines = makeCommands(entries);
+    uint64_t command_sum, bulk_sum;
+    double commands = measure(COMMANDS, entries, lines, &command_sum);
+    double bulk = measure(BULK, entries, lines, &bulk_sum);
+    printf("%8u routes: I commands %8.3f s, loadRoutes %8.3f s%s\n", n, commands, bulk,
+           command_sum == bulk_sum ? "" : "  MISMATCH");
+    failed |= command_sum != bulk_sum || commands < 0 || bulk < 0;
+    per_route_squared = commands / ((double)n * n);
+  }
+
+  const uint32_t bulk_sizes[] = {100000, 1000000};
+  for (uint32_t n : bulk_sizes) {
+    rng = 2463534242u;
+    vector<RoutingTableEntry> entries = makeTable(n);
+    vector<std::string> none;
+    uint64_t bulk_sum, file_sum;
+    double bulk = measure(BULK, entries, none, &bulk_sum);
+    // write the file from a table loaded in this process, then drop it with the process
+    pid_t pid = fork();
+    if (pid == 0) {
+      loadRoutes(entries.data(), entries.size());
+      _exit(saveRouteFile(ROUTE_FILE) ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    double file = measure(FILE_LOAD, entries, none, &file_sum);
+    printf("%8u routes: I commands ~%7.0f s (extrapolated), loadRoutes %8.3f s, "
+           "loadRouteFile %8.3f s%s\n",
+           n, per_route_squared * n * n, bulk, file, bulk_sum == file_sum ? "" : "  MISMATCH");
+    failed |= bulk_sum != file_sum || bulk < 0 || file < 0 || status != 0;
+  }
+  unlink(ROUTE_FILE);
+  if (failed) {
+    printf("FAILED\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
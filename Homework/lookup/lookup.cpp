@@ -1,10 +1,23 @@
+#include "fib.h"
+#include "ortc.h"
+#include "range.h"
+#include "rib.h"
 #include "rip.h"
 #include "router.h"
+#include "router_hal.h"
+#include "timer.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
 #include <vector>
 #include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 using std::vector;
 
 /*
@@ -22,36 +35,840 @@ using std::vector;
   保证 addr 仅最低 len 位可能出现非零。
   当 nexthop 为零时这是一条直连路由。
   你可以在全局变量中把路由表以一定的数据结构格式保存下来。
+
+  RouteTable 是控制面的路由表（RIB），只在主线程中读写。每个前缀是一个 RouteGroup ，
+  包含选中的全部等价路径，以及其他邻居通告的、没有被选中的备份路径，
+  两者合起来就是这个前缀在每个邻居的 Adj-RIB-In 中的表项，每一条都有自己的超时。
+  选中的路径失效后，metric 最小的备份路径立即接替，不用等邻居的下一次定期更新。
+  route_index 按 (addr, len) 索引，精确查找、插入和删除都是 O(1) ，
+  删除一个前缀时用最后一个前缀填上它的位置，所以 RouteTable 中前缀的顺序没有意义。
+  转发查询走 fib.h 中的 FIB，可以在多个线程中并发查询。
+  FIB 是 RIB 经过 ortc.h 聚合之后的结果，前缀和 RIB 并不一一对应。
+
+  编译时定义 LOOKUP_ENGINE_RANGE 则改用 range.h 中的区间表作为 query() 背后的查询结构，
+  RIB 直接展开成区间，不再经过聚合和 FIB ，FIB 快照和聚合统计也就不再有意义；
+  默认的 LOOKUP_ENGINE_TRIE 使用 FIB 。
 */
 
-vector<RoutingTableEntry> RouteTable;
+#ifdef LOOKUP_ENGINE_RANGE
+static inline void engineUpdate(uint32_t addr, uint32_t len, const FibEntry *entry) { rangeUpdate(addr, len, entry); }
+static inline void engineLoad(const FibRoute *routes, size_t count) { rangeLoad(routes, count); }
+static inline bool engineLookup(uint32_t addr, FibEntry *entry) { return rangeLookup(addr, entry); }
+static inline uint64_t engineGeneration() { return rangeGeneration(); }
+static inline void engineBegin() { rangeBegin(); }
+static inline void engineCommit() { rangeCommit(); }
+#else
+static inline void engineUpdate(uint32_t addr, uint32_t len, const FibEntry *entry) { ortcUpdate(addr, len, entry); }
+static inline void engineLoad(const FibRoute *routes, size_t count) { ortcLoad(routes, count); }
+static inline bool engineLookup(uint32_t addr, FibEntry *entry) { return fibLookup(addr, entry); }
+static inline uint64_t engineGeneration() { return fibGeneration(); }
+static inline void engineBegin() { fibBegin(); }
+static inline void engineCommit() { fibCommit(); }
+#endif
+
+// one prefix of the RIB, the first path is the one advertised; few prefixes have
+// equal-cost alternates or are heard from more than one neighbour, so those live apart
+typedef struct {
+  RoutingTableEntry first;
+  RoutingTableEntry *more; // FIB_MAX_PATHS - 1 entries, allocated with the second path
+  uint32_t paths;
+  vector<RoutingTableEntry> *backups; // paths not selected, NULL when there are none
+} RouteGroup;
+
+vector<RouteGroup> RouteTable;
+static std::unordered_map<uint64_t, uint32_t> route_index; // (addr, len) -> position in RouteTable
+
+static inline uint64_t routeKey(uint32_t addr, uint32_t len)
+{
+  return (uint64_t)addr << 6 | len;
+}
+
+static inline RoutingTableEntry &groupPath(RouteGroup &group, uint32_t i)
+{
+  return i ? group.more[i - 1] : group.first;
+}
+
+static RouteGroup *findGroup(uint32_t addr, uint32_t len)
+{
+  auto it = route_index.find(routeKey(addr, len));
+  return it == route_index.end() ? NULL : &RouteTable[it->second];
+}
+
+// appends a prefix with no paths yet
+static RouteGroup *addGroup(uint32_t addr, uint32_t len)
+{
+  route_index[routeKey(addr, len)] = RouteTable.size();
+  RouteGroup group;
+  group.first.addr = addr;
+  group.first.len = len;
+  group.more = NULL;
+  group.paths = 0;
+  group.backups = NULL;
+  RouteTable.push_back(group);
+  return &RouteTable.back();
+}
+
+// the last prefix takes the place of the removed one
+static void removeGroup(RouteGroup *group)
+{
+  uint32_t position = group - RouteTable.data();
+  route_index.erase(routeKey(group->first.addr, group->first.len));
+  delete[] group->more;
+  delete group->backups;
+  if (position + 1 != RouteTable.size()) {
+    *group = RouteTable.back();
+    route_index[routeKey(group->first.addr, group->first.len)] = position;
+  }
+  RouteTable.pop_back();
+}
+
+static void appendPath(RouteGroup *group, const RoutingTableEntry &entry)
+{
+  if (group->paths == 1 && !group->more) {
+    group->more = new RoutingTableEntry[FIB_MAX_PATHS - 1];
+  }
+  groupPath(*group, group->paths++) = entry;
+}
+
+static void removePath(RouteGroup *group, uint32_t i)
+{
+  for (; i + 1 < group->paths; i++) {
+    groupPath(*group, i) = groupPath(*group, i + 1);
+  }
+  group->paths--;
+}
+
+static void addBackup(RouteGroup *group, const RoutingTableEntry &entry)
+{
+  if (!group->backups) {
+    group->backups = new vector<RoutingTableEntry>;
+  }
+  group->backups->push_back(entry);
+}
+
+static void removeBackup(RouteGroup *group, size_t i)
+{
+  vector<RoutingTableEntry> &backups = *group->backups;
+  backups[i] = backups.back();
+  backups.pop_back();
+  if (backups.empty()) {
+    delete group->backups;
+    group->backups = NULL;
+  }
+}
+
+// RIP timers, ref. RFC2453 3.8
+#define ROUTE_TIMEOUT (180 * 1000)
+#define ROUTE_GC_TIME (120 * 1000)
+
+// the timeout of one learned path, allocated apart so that it stays put while RouteTable moves
+struct RouteTimer {
+  Timer timer;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t if_index;
+  uint32_t nexthop;
+};
+
+// a prefix whose last path was removed, advertised with metric 16 until garbage collected
+typedef struct {
+  Timer gc;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t if_index;
+  bool changed;
+  size_t index; // position in withdrawn
+} Withdrawal;
+
+static vector<Withdrawal *> withdrawn;
+static std::unordered_map<uint64_t, Withdrawal *> withdrawn_index;
+static bool route_changes = false;
+// bumped whenever what writeRipEntries() writes may have changed
+static uint64_t route_version = 0;
+
+static void markChanged(RoutingTableEntry &entry)
+{
+  entry.changed = true;
+  route_changes = true;
+  route_version++;
+}
+
+void update(bool insert, RoutingTableEntry entry, uint32_t if_index);
+
+static void routeTimeout(void *arg)
+{
+  RouteTimer *timeout = (RouteTimer *)arg;
+  RoutingTableEntry entry = {timeout->addr, timeout->len, timeout->if_index, timeout->nexthop, 0, false, NULL};
+  // frees timeout as well
+  update(false, entry, timeout->if_index);
+}
+
+// (re)starts the timeout of a learned path, direct routes never time out
+static void armTimeout(RoutingTableEntry &entry)
+{
+  if (entry.nexthop == 0) {
+    return;
+  }
+  if (!entry.timeout) {
+    entry.timeout = new RouteTimer;
+    timerInit(&entry.timeout->timer, routeTimeout, entry.timeout);
+  }
+  entry.timeout->addr = entry.addr;
+  entry.timeout->len = entry.len;
+  entry.timeout->if_index = entry.if_index;
+  entry.timeout->nexthop = entry.nexthop;
+  timerArm(&entry.timeout->timer, ROUTE_TIMEOUT);
+}
+
+static void freeTimeout(RoutingTableEntry &entry)
+{
+  if (entry.timeout) {
+    timerCancel(&entry.timeout->timer);
+    delete entry.timeout;
+    entry.timeout = NULL;
+  }
+}
+
+// drops every path of a prefix, selected or not
+static void clearPaths(RouteGroup *group)
+{
+  for (uint32_t i = 0; i < group->paths; i++) {
+    freeTimeout(groupPath(*group, i));
+  }
+  group->paths = 0;
+  if (group->backups) {
+    for (size_t i = 0; i < group->backups->size(); i++) {
+      freeTimeout((*group->backups)[i]);
+    }
+    delete group->backups;
+    group->backups = NULL;
+  }
+}
+
+// moves the best backups up while the selected paths have room: all of the smallest
+// metric when none is left, those as good as the selected ones otherwise
+static bool promoteBackups(RouteGroup *group)
+{
+  if (!group->backups) {
+    return false;
+  }
+  vector<RoutingTableEntry> &backups = *group->backups;
+  uint32_t best = 16;
+  if (group->paths) {
+    best = ntohl(group->first.metric);
+  } else {
+    for (size_t i = 0; i < backups.size(); i++) {
+      best = std::min<uint32_t>(best, ntohl(backups[i].metric));
+    }
+  }
+  bool promoted = false;
+  for (size_t i = 0; i < backups.size() && group->paths < FIB_MAX_PATHS;) {
+    if (ntohl(backups[i].metric) == best) {
+      markChanged(backups[i]);
+      appendPath(group, backups[i]);
+      removeBackup(group, i);
+      promoted = true;
+      if (!group->backups) {
+        break;
+      }
+    } else {
+      i++;
+    }
+  }
+  return promoted;
+}
+
+static void removeWithdrawal(Withdrawal *w)
+{
+  timerCancel(&w->gc);
+  withdrawn_index.erase(routeKey(w->addr, w->len));
+  withdrawn[w->index] = withdrawn.back();
+  withdrawn[w->index]->index = w->index;
+  withdrawn.pop_back();
+  delete w;
+  route_version++;
+}
+
+static void withdrawalGarbageCollect(void *arg)
+{
+  removeWithdrawal((Withdrawal *)arg);
+}
+
+static void addWithdrawal(uint32_t addr, uint32_t len, uint32_t if_index)
+{
+  Withdrawal *w = new Withdrawal;
+  w->addr = addr;
+  w->len = len;
+  w->if_index = if_index;
+  w->changed = true;
+  w->index = withdrawn.size();
+  withdrawn.push_back(w);
+  withdrawn_index[routeKey(addr, len)] = w;
+  timerInit(&w->gc, withdrawalGarbageCollect, w);
+  timerArm(&w->gc, ROUTE_GC_TIME);
+  route_changes = true;
+  route_version++;
+}
+
+static void forgetWithdrawal(uint32_t addr, uint32_t len)
+{
+  auto it = withdrawn_index.find(routeKey(addr, len));
+  if (it != withdrawn_index.end()) {
+    removeWithdrawal(it->second);
+  }
+}
+
+// prefixes to feed to the lookup engine when the open transaction commits
+static bool transaction_open = false;
+static vector<uint64_t> pending_sync;
+
+// feed the equal-cost group of one prefix to the lookup engine
+static void syncPrefix(uint32_t addr, uint32_t len)
+{
+  FibEntry fibEntry;
+  fibEntry.paths = 0;
+  RouteGroup *group = findGroup(addr, len);
+  for (uint32_t i = 0; group && i < group->paths && i < FIB_MAX_PATHS; i++) {
+    const RoutingTableEntry &path = groupPath(*group, i);
+    fibEntry.metric = path.metric;
+    fibEntry.nexthop[fibEntry.paths] = path.nexthop;
+    fibEntry.if_index[fibEntry.paths] = path.if_index;
+    fibEntry.paths++;
+  }
+  engineUpdate(addr, len, fibEntry.paths ? &fibEntry : NULL);
+}
+
+static void syncFib(uint32_t addr, uint32_t len)
+{
+  if (transaction_open) {
+    pending_sync.push_back(routeKey(addr, len));
+  } else {
+    syncPrefix(addr, len);
+  }
+}
 
 /**
  * @brief 插入/删除一条路由表表项
  * @param insert 如果要插入则为 true ，要删除则为 false
  * @param entry 要插入/删除的表项
  * 
- * 插入时如果已经存在一条 addr 和 len 都相同的表项，则替换掉原有的。
- * 删除时按照 addr 和 len 匹配。
+ * 插入时如果已经存在 addr 和 len 都相同的表项（包括它的等价路径和备份路径），则替换掉原有的。
+ * 删除时按照 addr 、 len 和 if_index 匹配，entry.nexthop 不为零时还要匹配 nexthop ，
+ * 只删除等价路径组或者备份路径中的这一条路径；选中的路径删完时由最好的备份路径接替。
+ * if_index 为 ROUTE_ANY_INTERFACE 时删除这个前缀的所有路径，包括备份路径。
+ * 插入和删除都会标记这个前缀有变化，留给下一次触发更新发送，见 writeRipEntries() 。
+ * 插入的 nexthop 不为零时，这条路径在 ROUTE_TIMEOUT 内没有被再次插入或者刷新（见 addEqualCostPath()）
+ * 就会被删除；删除前缀的最后一条路径后，它以 metric 16 继续发送 ROUTE_GC_TIME ，ref. RFC2453 3.8 。
+ * 定时器由 timer.h 的时间轮驱动。
  */
 void update(bool insert, RoutingTableEntry entry, uint32_t if_index = 0)
 {
+  RouteGroup *group = findGroup(entry.addr, entry.len);
   if (insert) {
-    for (auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
-      if ((*it).addr == entry.addr && (*it).len == entry.len) {
-        RouteTable.erase(it);
-        break;
+    if (group) {
+      clearPaths(group);
+    } else {
+      group = addGroup(entry.addr, entry.len);
+    }
+    markChanged(entry);
+    forgetWithdrawal(entry.addr, entry.len);
+    entry.timeout = NULL;
+    armTimeout(entry);
+    appendPath(group, entry);
+    syncFib(entry.addr, entry.len);
+  } else if (group && if_index == ROUTE_ANY_INTERFACE) {
+    // withdrawn towards everyone but the interface of the selected path
+    uint32_t withdrawn_if = group->first.if_index;
+    clearPaths(group);
+    removeGroup(group);
+    addWithdrawal(entry.addr, entry.len, withdrawn_if);
+    syncFib(entry.addr, entry.len);
+  } else if (group) {
+    for (uint32_t i = 0; i < group->paths; i++) {
+      RoutingTableEntry &path = groupPath(*group, i);
+      if (path.if_index == if_index && (entry.nexthop == 0 || path.nexthop == entry.nexthop)) {
+        freeTimeout(path);
+        removePath(group, i);
+        if (group->paths == 0 && !promoteBackups(group)) {
+          removeGroup(group);
+          addWithdrawal(entry.addr, entry.len, if_index);
+        } else {
+          // the rest of the group may now be advertised differently
+          promoteBackups(group);
+          for (uint32_t j = 0; j < group->paths; j++) {
+            markChanged(groupPath(*group, j));
+          }
+        }
+        syncFib(entry.addr, entry.len);
+        return;
       }
     }
-    RouteTable.push_back(entry);
-  } else {
-    for (auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
-      if ((*it).addr == entry.addr && (*it).len == entry.len && (*it).if_index == if_index) {
-        RouteTable.erase(it);
+    // a backup goes without the selected paths noticing
+    for (size_t i = 0; group->backups && i < group->backups->size(); i++) {
+      RoutingTableEntry &path = (*group->backups)[i];
+      if (path.if_index == if_index && (entry.nexthop == 0 || path.nexthop == entry.nexthop)) {
+        freeTimeout(path);
+        removeBackup(group, i);
         break;
       }
     }
-  }    
+  }
+}
+
+// the neighbour's advertisement replaces its earlier one, then the smallest metric wins:
+// a better path takes over and the old ones become backups, an equal one joins the
+// equal-cost group while it has room, anything else waits as a backup
+static void advertise(RoutingTableEntry entry)
+{
+  RouteGroup *group = findGroup(entry.addr, entry.len);
+  if (!group) {
+    update(true, entry);
+    return;
+  }
+  entry.changed = false;
+  entry.timeout = NULL;
+  bool was_selected = false;
+  for (uint32_t i = 0; i < group->paths; i++) {
+    RoutingTableEntry &path = groupPath(*group, i);
+    if (path.nexthop == entry.nexthop) {
+      if (path.metric == entry.metric) {
+        // a refresh of a path we use, nothing new to advertise
+        bool moved = path.if_index != entry.if_index;
+        entry.changed = path.changed;
+        entry.timeout = path.timeout;
+        armTimeout(entry);
+        path = entry;
+        if (moved) {
+          // split horizon now skips another interface
+          route_version++;
+          syncFib(entry.addr, entry.len);
+        }
+        return;
+      }
+      entry.timeout = path.timeout;
+      removePath(group, i);
+      was_selected = true;
+      break;
+    }
+  }
+  for (size_t i = 0; !was_selected && group->backups && i < group->backups->size(); i++) {
+    if ((*group->backups)[i].nexthop == entry.nexthop) {
+      entry.timeout = (*group->backups)[i].timeout;
+      removeBackup(group, i);
+      break;
+    }
+  }
+  armTimeout(entry);
+
+  if (group->paths == 0) {
+    // the only selected path got worse, it may not be the best any more
+    addBackup(group, entry);
+    promoteBackups(group);
+  } else if (ntohl(entry.metric) < ntohl(group->first.metric)) {
+    for (uint32_t i = 0; i < group->paths; i++) {
+      addBackup(group, groupPath(*group, i));
+    }
+    group->paths = 0;
+    markChanged(entry);
+    appendPath(group, entry);
+  } else if (entry.metric == group->first.metric && group->paths < FIB_MAX_PATHS) {
+    route_version++;
+    appendPath(group, entry);
+  } else {
+    addBackup(group, entry);
+    if (!was_selected) {
+      return;
+    }
+    // an equal-cost backup may fill the place, and the rest of the group may now be
+    // advertised differently
+    promoteBackups(group);
+    for (uint32_t i = 0; i < group->paths; i++) {
+      markChanged(groupPath(*group, i));
+    }
+  }
+  syncFib(entry.addr, entry.len);
+}
+
+/**
+ * @brief 在 RIB 中按照 addr 和 len 精确查找一个前缀，控制面比较 metric 时使用
+ * @param addr 前缀地址，大端序
+ * @param len 前缀长度
+ * @param entry 查到时写入这个前缀的（第一条）表项
+ * @return 查到则返回 true ，没查到则返回 false
+ */
+bool lookupRoute(uint32_t addr, uint32_t len, RoutingTableEntry *entry)
+{
+  RouteGroup *group = findGroup(addr, len);
+  if (group) {
+    *entry = group->first;
+  }
+  return group != NULL;
+}
+
+RibTransaction::RibTransaction() : open(true)
+{
+  transaction_open = true;
+}
+
+RibTransaction::~RibTransaction()
+{
+  if (open) {
+    commit();
+  }
+}
+
+void RibTransaction::apply(uint32_t addr, uint32_t len, uint32_t if_index, uint32_t nexthop, uint32_t metric)
+{
+  RoutingTableEntry entry = {addr, len, if_index, nexthop, metric, false, NULL};
+  if (ntohl(metric) >= 16) {
+    // unreachable through this neighbour, drop its path only; a backup takes over
+    update(false, entry, if_index);
+  } else {
+    advertise(entry);
+  }
+}
+
+void RibTransaction::applyResponse(const RipPacketView &rip, uint32_t if_index, uint32_t src_addr)
+{
+  for (RipEntryView entry : rip) {
+    // parse() made sure the mask is contiguous
+    apply(entry.addr(), __builtin_popcount(entry.mask()), if_index, src_addr, entry.metric());
+  }
+}
+
+uint32_t RibTransaction::commit()
+{
+  open = false;
+  transaction_open = false;
+  std::sort(pending_sync.begin(), pending_sync.end());
+  pending_sync.erase(std::unique(pending_sync.begin(), pending_sync.end()), pending_sync.end());
+  uint32_t changes = pending_sync.size();
+  if (changes) {
+    engineBegin();
+    for (uint64_t key : pending_sync) {
+      syncPrefix(key >> 6, key & 63);
+    }
+    engineCommit();
+  }
+  pending_sync.clear();
+  return changes;
+}
+
+static bool routeLess(const RoutingTableEntry &a, const RoutingTableEntry &b)
+{
+  uint32_t x = ntohl(a.addr), y = ntohl(b.addr);
+  return x != y ? x < y : a.len < b.len;
+}
+
+/**
+ * @brief 批量插入路由表表项，比逐条 update(true, ...) 快得多，适合启动时导入整张表
+ * @param entries 要插入的表项，不要求有序
+ * @param count 表项个数
+ *
+ * 效果与按顺序逐条调用 update(true, entries[i]) 相同：同一前缀以最后一条为准，
+ * 并替换掉 RouteTable 中已有的同一前缀（包括它的等价路径和备份路径）。
+ * 表项只排序一次，FIB 自底向上一次性建好，再整体替换掉原来的 FIB 。
+ * 导入的前缀都标记为有变化，但不会超时。
+ */
+void loadRoutes(const RoutingTableEntry *entries, size_t count)
+{
+  vector<RoutingTableEntry> sorted(entries, entries + count);
+  std::stable_sort(sorted.begin(), sorted.end(), routeLess);
+  size_t n = 0;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    if (n > 0 && sorted[n - 1].addr == sorted[i].addr && sorted[n - 1].len == sorted[i].len) {
+      sorted[n - 1] = sorted[i];
+    } else {
+      sorted[n++] = sorted[i];
+    }
+    markChanged(sorted[n - 1]);
+    sorted[n - 1].timeout = NULL;
+  }
+  sorted.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    forgetWithdrawal(sorted[i].addr, sorted[i].len);
+  }
+
+  RouteTable.reserve(RouteTable.size() + n);
+  route_index.reserve(RouteTable.size() + n);
+  for (size_t i = 0; i < n; i++) {
+    RouteGroup *group = findGroup(sorted[i].addr, sorted[i].len);
+    if (group) {
+      clearPaths(group);
+    } else {
+      group = addGroup(sorted[i].addr, sorted[i].len);
+    }
+    appendPath(group, sorted[i]);
+  }
+
+  vector<FibRoute> routes(n);
+  for (size_t i = 0; i < n; i++) {
+    routes[i].addr = sorted[i].addr;
+    routes[i].len = sorted[i].len;
+    routes[i].entry.metric = sorted[i].metric;
+    routes[i].entry.paths = 1;
+    routes[i].entry.nexthop[0] = sorted[i].nexthop;
+    routes[i].entry.if_index[0] = sorted[i].if_index;
+  }
+  engineLoad(routes.data(), n);
+}
+
+/*
+  二进制路由表文件：一个文件头，后面紧跟 count 条 20 字节的记录。
+  addr 和 nexthop 与 RoutingTableEntry 一样是大端序，其余字段都是小端序，
+  每个字段都和 RoutingTableEntry 一样宽，写文件时不会截断。
+*/
+#define ROUTE_FILE_MAGIC 0x42415452 // "RTAB"
+#define ROUTE_FILE_VERSION 2
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+} RouteFileHeader;
+
+typedef struct {
+  uint32_t addr;
+  uint32_t nexthop;
+  uint32_t len;
+  uint32_t if_index;
+  uint32_t metric;
+} RouteFileRecord;
+
+/**
+ * @brief 从二进制路由表文件中批量导入路由，见 loadRoutes()
+ * @param path 文件路径
+ * @return 成功则返回 true ；文件不存在或格式不对则返回 false ，路由表不变。
+ * 文件长度必须和 count 一致；前缀长度超过 32 、地址的主机位不为 0 或者出端口不存在的记录
+ * 都算格式不对
+ */
+bool loadRouteFile(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  RouteFileHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != ROUTE_FILE_MAGIC ||
+      header.version != ROUTE_FILE_VERSION) {
+    fclose(fp);
+    return false;
+  }
+  // count comes from the file, check it against the size before allocating for it
+  long size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0) {
+    size = ftell(fp);
+  }
+  if (size < 0 ||
+      (uint64_t)size != sizeof(header) + (uint64_t)header.count * sizeof(RouteFileRecord) ||
+      fseek(fp, sizeof(header), SEEK_SET) != 0) {
+    fclose(fp);
+    return false;
+  }
+  vector<RouteFileRecord> records(header.count);
+  if (fread(records.data(), sizeof(RouteFileRecord), header.count, fp) != header.count) {
+    fclose(fp);
+    return false;
+  }
+  fclose(fp);
+  vector<RoutingTableEntry> entries(header.count);
+  for (uint32_t i = 0; i < header.count; i++) {
+    const RouteFileRecord &record = records[i];
+    if (record.len > 32 || record.if_index >= N_IFACE_ON_BOARD) {
+      return false;
+    }
+    uint32_t mask = record.len ? 0xffffffffu << (32 - record.len) : 0;
+    if ((ntohl(record.addr) & ~mask) != 0) {
+      return false;
+    }
+    entries[i].addr = record.addr;
+    entries[i].len = record.len;
+    entries[i].if_index = record.if_index;
+    entries[i].nexthop = record.nexthop;
+    entries[i].metric = htonl(record.metric);
+  }
+  loadRoutes(entries.data(), entries.size());
+  return true;
+}
+
+/**
+ * @brief 把当前的 RouteTable 写成二进制路由表文件，每个前缀只写它的第一条路径
+ * @param path 文件路径
+ * @return 成功则返回 true ，失败则返回 false
+ */
+bool saveRouteFile(const char *path)
+{
+  vector<RouteFileRecord> records;
+  for (auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
+    const RoutingTableEntry &first = (*it).first;
+    RouteFileRecord record = {first.addr, first.nexthop, first.len, first.if_index,
+                              ntohl(first.metric)};
+    records.push_back(record);
+  }
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    return false;
+  }
+  RouteFileHeader header = {ROUTE_FILE_MAGIC, ROUTE_FILE_VERSION, (uint32_t)records.size()};
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+            fwrite(records.data(), sizeof(RouteFileRecord), records.size(), fp) == records.size();
+  return fclose(fp) == 0 && ok;
+}
+
+/*
+  query() 前面有一个按线程独立的 4 路组相联缓存，缓存目标地址到查询结果的映射，
+  查不到的结果也会缓存。每一项记录填入时查询结构（FIB 或区间表）的版本号，update() 修改后
+  版本号加一，所有旧的项就同时失效了。
+*/
+#define QUERY_CACHE_SETS 1024 // 2 的幂
+#define QUERY_CACHE_WAYS 4
+// one in this many hits and misses is timed to estimate the cycles saved
+#define QUERY_CACHE_SAMPLE 64
+
+typedef struct {
+  uint64_t generation;
+  uint32_t addr;
+  uint32_t found;
+  FibEntry entry;
+} QueryCacheLine;
+
+typedef struct {
+  QueryCacheLine ways[QUERY_CACHE_WAYS];
+} QueryCacheSet;
+
+typedef struct {
+  QueryCacheSet sets[QUERY_CACHE_SETS];
+  uint8_t victim[QUERY_CACHE_SETS];
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t hit_cycles;
+  uint64_t miss_cycles;
+  uint64_t hit_samples;
+  uint64_t miss_samples;
+} QueryCache;
+
+static thread_local QueryCache query_cache;
+
+// TSC on x86, nanoseconds elsewhere
+static inline uint64_t cycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+static inline uint32_t querySet(uint32_t addr) {
+  return (addr * 2654435761u) >> 22 & (QUERY_CACHE_SETS - 1);
+}
+
+static bool cachedLookup(uint32_t addr, FibEntry *entry) {
+  QueryCache &cache = query_cache;
+  uint64_t generation = engineGeneration();
+  uint32_t set_index = querySet(addr);
+  QueryCacheSet &set = cache.sets[set_index];
+  for (int i = 0; i < QUERY_CACHE_WAYS; i++) {
+    QueryCacheLine &line = set.ways[i];
+    if (line.generation == generation && line.addr == addr) {
+      cache.hits++;
+      *entry = line.entry;
+      return line.found;
+    }
+  }
+  cache.misses++;
+  bool found = engineLookup(addr, entry);
+  // prefer a stale way, otherwise round robin
+  int way = -1;
+  for (int i = 0; i < QUERY_CACHE_WAYS; i++) {
+    if (set.ways[i].generation != generation) {
+      way = i;
+      break;
+    }
+  }
+  if (way < 0) {
+    way = cache.victim[set_index];
+    cache.victim[set_index] = (way + 1) % QUERY_CACHE_WAYS;
+  }
+  QueryCacheLine &line = set.ways[way];
+  line.generation = generation;
+  line.addr = addr;
+  line.found = found;
+  line.entry = *entry;
+  return found;
+}
+
+static bool sampledLookup(uint32_t addr, FibEntry *entry) {
+  QueryCache &cache = query_cache;
+  uint64_t before_hits = cache.hits;
+  uint64_t begin = cycleCounter();
+  bool found = cachedLookup(addr, entry);
+  uint64_t cycles = cycleCounter() - begin;
+  if (cache.hits != before_hits) {
+    cache.hit_cycles += cycles;
+    cache.hit_samples++;
+  } else {
+    cache.miss_cycles += cycles;
+    cache.miss_samples++;
+  }
+  return found;
+}
+
+/**
+ * @brief 计算 IP 包的流哈希，同一条流（源、目的地址，协议，TCP/UDP 端口）的哈希值相同
+ * @param packet IP 包
+ * @param len 即 packet 的长度
+ * @return 哈希值；分片的包不使用端口，这样同一条流的分片不会走不同的路径
+ */
+uint32_t flowHash(const uint8_t *packet, size_t len)
+{
+  uint32_t src = ntohl(IPv4Wire::Src::load(packet));
+  uint32_t dst = ntohl(IPv4Wire::Dst::load(packet));
+  uint32_t protocol = IPv4Wire::Protocol::load(packet);
+  uint32_t ports = 0;
+  size_t header = 4 * (IPv4Wire::VersionIhl::load(packet) & 0xf);
+  bool fragment = (IPv4Wire::FlagsFragment::load(packet) & IPv4Wire::FRAGMENT_MASK) != 0;
+  if ((protocol == 6 || protocol == 17) && !fragment && len >= header + 4) {
+    // TCP has its ports where UDP does
+    ports = (uint32_t)UdpWire::SrcPort::load(packet + header) << 16 | UdpWire::DstPort::load(packet + header);
+  }
+  // murmur3 finalizer over the folded tuple
+  uint32_t hash = src * 0x9e3779b1u ^ dst;
+  hash = (hash ^ ports) * 0x85ebca6bu ^ protocol;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+/**
+ * @brief 进行一次路由表的查询，按照最长前缀匹配原则，有等价路径时按流哈希选择其中一条
+ * @param addr 需要查询的目标地址，大端序
+ * @param flow_hash 流哈希，见 flowHash()
+ * @param nexthop 如果查询到目标，把选中路径的 nexthop 写入
+ * @param if_index 如果查询到目标，把选中路径的 if_index 写入
+ * @return 查到则返回 true ，没查到则返回 false
+ */
+bool queryFlow(uint32_t addr, uint32_t flow_hash, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric)
+{
+  FibEntry entry;
+  QueryCache &cache = query_cache;
+  bool found = (cache.hits + cache.misses) % QUERY_CACHE_SAMPLE == 0
+                   ? sampledLookup(addr, &entry)
+                   : cachedLookup(addr, &entry);
+  if (!found) {
+    *nexthop = 0;
+    *if_index = 0;
+    return false;
+  }
+  uint32_t path = ((uint64_t)flow_hash * entry.paths) >> 32;
+  *nexthop = entry.nexthop[path];
+  *if_index = entry.if_index[path];
+  *metric = entry.metric;
+  return true;
 }
 
 /**
@@ -60,54 +877,126 @@ void update(bool insert, RoutingTableEntry entry, uint32_t if_index = 0)
  * @param nexthop 如果查询到目标，把表项的 nexthop 写入
  * @param if_index 如果查询到目标，把表项的 if_index 写入
  * @return 查到则返回 true ，没查到则返回 false
+ *
+ * 有等价路径时总是返回第一条路径。
  */
 bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric)
 {
-  *nexthop = 0;
-  *if_index = 0;
-  bool flag = false;
-  uint32_t maxlen = 0;
-  uint32_t laddr = ntohl(addr);
-  for(auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
-    uint32_t tmpaddr = ntohl((*it).addr);
-    int mov = 32 - (*it).len;
-    if((laddr >> mov) == (tmpaddr >> mov)) {
-      flag = true;
-      if(maxlen < (*it).len) {
-        maxlen = (*it).len;
-        *nexthop = (*it).nexthop;
-        *if_index = (*it).if_index;
-        *metric = (*it).metric;
-      }
+  return queryFlow(addr, 0, nexthop, if_index, metric);
+}
+
+/**
+ * @brief 读取当前线程 query() 缓存的统计
+ * @param hits 命中次数
+ * @param misses 未命中次数
+ * @param cycles_saved 估算的节省周期数（x86 上是 TSC 周期，其他平台是纳秒），
+ *        即命中次数乘以未命中与命中的平均开销之差
+ */
+void queryCacheStats(uint64_t *hits, uint64_t *misses, uint64_t *cycles_saved)
+{
+  QueryCache &cache = query_cache;
+  *hits = cache.hits;
+  *misses = cache.misses;
+  *cycles_saved = 0;
+  if (cache.hit_samples && cache.miss_samples) {
+    double hit_cost = (double)cache.hit_cycles / cache.hit_samples;
+    double miss_cost = (double)cache.miss_cycles / cache.miss_samples;
+    if (miss_cost > hit_cost) {
+      *cycles_saved = (uint64_t)((miss_cost - hit_cost) * cache.hits);
     }
   }
-  return flag;
 }
 
-void buildRipPacket(RipPacket *resp, uint32_t if_index) {
-  resp->numEntries = RouteTable.size();
-  resp->command = 2;
-  int i = 0;
-  for (auto tableEntry : RouteTable) {
-    if(tableEntry.if_index == if_index){
-      resp->numEntries--;
+static void writeRipEntry(uint8_t *entry, uint32_t addr, uint32_t len, uint32_t nexthop, uint32_t metric)
+{
+  RipEntry route = {addr, htonl(len ? 0xffffffffu << (32 - len) : 0), nexthop, htonl(metric)};
+  ripWriteEntry(entry, 0x2, route);
+}
+
+/**
+ * @brief 把路由表按顺序写成 RIP Response 的表项，用于把整张表分成多个 RIP 包发送
+ * @param if_index 要发往的端口，从这个端口学到的前缀不写（水平分割）
+ * @param changed_only 为 true 时只写有变化的前缀，用于触发更新
+ * @param cursor 从第 *cursor 项开始，返回时指向下一次开始的位置；第一次调用时为 0
+ * @param buffer 按 RIP 的格式写入表项，每项 RIP_ENTRY_SIZE 字节
+ * @param max 最多写入的表项数
+ * @return 写入的表项数，为 0 表示已经写完
+ *
+ * 先写 RouteTable ，再写最后一条路径被删除、还没有被垃圾回收的前缀（metric 为 16）。
+ * 连续调用直到返回 0 ，整张表只遍历一遍。等价路径组只写一次，metric 加一，最大为 16 。
+ * 两次调用之间不能修改路由表。
+ */
+uint32_t writeRipEntries(uint32_t if_index, bool changed_only, size_t *cursor, uint8_t *buffer, uint32_t max)
+{
+  uint32_t count = 0;
+  size_t i = *cursor;
+  for (; i < RouteTable.size() && count < max; i++) {
+    RouteGroup &group = RouteTable[i];
+    bool learned_here = false;
+    bool changed = false;
+    for (uint32_t j = 0; j < group.paths; j++) {
+      learned_here |= groupPath(group, j).if_index == if_index;
+      changed |= groupPath(group, j).changed;
+    }
+    if (learned_here || (changed_only && !changed)) {
       continue;
     }
-    uint32_t mask = ntohl(((1 << tableEntry.len) - 1) << (32 - tableEntry.len));
-    RipEntry ripEntry = {
-        .addr = tableEntry.addr,
-        .mask = mask,
-        .nexthop = tableEntry.nexthop,
-        .metric = tableEntry.metric + 0x01000000
-    };
-    resp->entries[i] = ripEntry;
-    i++;
+    const RoutingTableEntry &first = group.first;
+    uint32_t metric = std::min<uint32_t>(ntohl(first.metric) + 1, 16);
+    writeRipEntry(buffer + count * RIP_ENTRY_SIZE, first.addr, first.len, first.nexthop, metric);
+    count++;
+  }
+  for (; i >= RouteTable.size() && i < RouteTable.size() + withdrawn.size() && count < max; i++) {
+    const Withdrawal *w = withdrawn[i - RouteTable.size()];
+    if (w->if_index != if_index && (!changed_only || w->changed)) {
+      writeRipEntry(buffer + count * RIP_ENTRY_SIZE, w->addr, w->len, 0, 16);
+      count++;
+    }
+  }
+  *cursor = i;
+  return count;
+}
+
+/**
+ * @brief 是否有还没有在触发更新中发送的变化
+ * @return 有则返回 true
+ */
+bool routeChangesPending()
+{
+  return route_changes;
+}
+
+/**
+ * @brief 路由表的版本号，writeRipEntries() 写出的完整路由表可能变化时加一
+ * @return 版本号，与上次取得的相同说明可以继续使用之前写出的 RIP 包
+ */
+uint64_t routeTableVersion()
+{
+  return route_version;
+}
+
+/**
+ * @brief 发送完触发更新或者定期的完整更新之后，清除所有前缀的变化标记
+ */
+void clearRouteChanges()
+{
+  for (auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
+    for (uint32_t i = 0; i < (*it).paths; i++) {
+      groupPath(*it, i).changed = false;
+    }
+  }
+  for (size_t i = 0; i < withdrawn.size(); i++) {
+    withdrawn[i]->changed = false;
   }
+  route_changes = false;
 }
 
 void printRoutingTable() {
   printf("RouteTable:\n");
-  for (auto it = RouteTable.begin(); it != RouteTable.end(); it++) {
-    printf("%d.%d.%d.%d/%d, %d, ->%d.%d.%d.%d, %d\n", (*it).addr & 0xff, ((*it).addr >> 8) & 0xff, ((*it).addr >> 16) & 0xff, ((*it).addr >> 24) & 0xff, (*it).len, (*it).if_index, (*it).nexthop & 0xff, ((*it).nexthop >> 8) & 0xff, ((*it).nexthop >> 16) & 0xff, ((*it).nexthop >> 24) & 0xff, ntohl((*it).metric));
+  for (auto group = RouteTable.begin(); group != RouteTable.end(); group++) {
+    for (uint32_t i = 0; i < (*group).paths; i++) {
+      const RoutingTableEntry *it = &groupPath(*group, i);
+      printf("%d.%d.%d.%d/%d, %d, ->%d.%d.%d.%d, %d\n", (*it).addr & 0xff, ((*it).addr >> 8) & 0xff, ((*it).addr >> 16) & 0xff, ((*it).addr >> 24) & 0xff, (*it).len, (*it).if_index, (*it).nexthop & 0xff, ((*it).nexthop >> 8) & 0xff, ((*it).nexthop >> 16) & 0xff, ((*it).nexthop >> 24) & 0xff, ntohl((*it).metric));
+    }
   }
 }
\ No newline at end of file
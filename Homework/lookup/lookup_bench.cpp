@@ -0,0 +1,503 @@
+#include "router.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using std::vector;
+
+// 查询结构的基准测试，按编译时选择的 LOOKUP_ENGINE 分别编译（make bench）。
+// 生成前缀长度分布接近 BGP 全表的路由表（ 1k 到 1M 条），用 loadRoutes() 导入后，
+// 分别用三种目标地址序列通过 query() 查询：路由过的前缀中均匀选取（uniform）、
+// Zipf 分布的热点目的地址（zipf）、命令行给出的 pcap 抓包中的目的地址（trace）；
+// 再在查询之间穿插 update() 增删前缀，测量更新速率和此时的查询速率。
+// 所有结果都与原来逐条扫描的线性实现对照，小规模的表也测一遍线性实现作为基线。
+// 每个规模在单独的子进程中运行，结果以 JSON 写到标准输出。
+
+extern void update(bool insert, RoutingTableEntry entry, uint32_t if_index);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+extern void loadRoutes(const RoutingTableEntry *entries, size_t count);
+extern void queryCacheStats(uint64_t *hits, uint64_t *misses, uint64_t *cycles_saved);
+
+#ifdef LOOKUP_ENGINE_RANGE
+#define ENGINE_NAME "range"
+#else
+#define ENGINE_NAME "trie"
+#endif
+
+#define N_NEIGHBOURS 16
+#define N_LOOKUPS 2000000
+#define N_TIMED 200000     // lookups timed one by one for the percentiles
+#define N_ZIPF_DSTS 100000
+#define ZIPF_SKEW 1.0
+#define N_CHURN 2000
+#define CHURN_SECONDS 3.0  // stop churning earlier on large tables
+#define LOOKUPS_PER_UPDATE 100
+#define LINEAR_MAX_PREFIXES 10000
+#define LINEAR_BUDGET 1e9  // prefixes scanned per linear run
+#define NESTED_PERCENT 35  // more-specifics carved out of an existing shorter prefix
+
+typedef bool (*QueryFn)(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+
+// prefix length distribution of a recent IPv4 BGP table, per 10000 prefixes
+static const uint32_t length_weights[33] = {
+    0,   0,   0,   0,  0,  0,  0,  0,  1,   1,   1,   1,    3,    6,    11, 19, 140,
+    80,  130, 230, 400, 500, 1200, 1100, 5900, 40, 40, 30, 30, 27, 30, 10, 70};
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static inline uint32_t prefixMask(uint32_t len) {
+  return len ? 0xffffffffu << (32 - len) : 0;
+}
+
+// the linear implementation this directory started with, used as the reference
+static vector<RoutingTableEntry> linear_table;
+
+static void linearUpdate(bool insert, RoutingTableEntry entry, uint32_t if_index) {
+  for (auto it = linear_table.begin(); it != linear_table.end(); it++) {
+    if ((*it).addr == entry.addr && (*it).len == entry.len &&
+        (insert || (*it).if_index == if_index)) {
+      linear_table.erase(it);
+      break;
+    }
+  }
+  if (insert) {
+    linear_table.push_back(entry);
+  }
+}
+
+static bool linearQuery(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric) {
+  *nexthop = 0;
+  *if_index = 0;
+  bool flag = false;
+  uint32_t maxlen = 0;
+  uint32_t laddr = ntohl(addr);
+  for (auto it = linear_table.begin(); it != linear_table.end(); it++) {
+    uint32_t tmpaddr = ntohl((*it).addr);
+    if ((laddr & prefixMask((*it).len)) == tmpaddr) {
+      if (!flag || maxlen < (*it).len) {
+        maxlen = (*it).len;
+        *nexthop = (*it).nexthop;
+        *if_index = (*it).if_index;
+        *metric = (*it).metric;
+      }
+      flag = true;
+    }
+  }
+  return flag;
+}
+
+// BGP-like prefixes without duplicates: lengths from length_weights, first octets
+// from unicast space, a third of them nested inside shorter prefixes, and next hops
+// mostly following the /12 they fall in, like routes learned from one upstream
+class TableGenerator {
+public:
+  TableGenerator() : block_hop(1 << 12) {
+    for (auto &hop : block_hop) {
+      hop = xorshift() % N_NEIGHBOURS;
+    }
+  }
+
+  RoutingTableEntry next() {
+    for (;;) {
+      uint32_t len = randomLength();
+      uint32_t addr;
+      const RoutingTableEntry *parent =
+          prefixes.empty() ? NULL : &prefixes[xorshift() % prefixes.size()];
+      if (parent && parent->len < len && xorshift() % 100 < NESTED_PERCENT) {
+        addr = ntohl(parent->addr) | (xorshift() & ~prefixMask(parent->len));
+      } else {
+        uint32_t octet;
+        do {
+          octet = 1 + xorshift() % 223;
+        } while (octet == 10 || octet == 127);
+        addr = octet << 24 | (xorshift() & 0xffffff);
+      }
+      addr &= prefixMask(len);
+      if (!used.insert((uint64_t)addr << 6 | len).second) {
+        continue;
+      }
+      uint32_t hop = xorshift() % 100 < 85 ? block_hop[addr >> 20] : xorshift() % N_NEIGHBOURS;
+      RoutingTableEntry entry = {htonl(addr), len, hop % 4, htonl(0x0a000001 + hop), htonl(1), false, NULL};
+      prefixes.push_back(entry);
+      return entry;
+    }
+  }
+
+private:
+  static uint32_t randomLength() {
+    uint32_t r = xorshift() % 10000;
+    uint32_t len = 0;
+    while (r >= length_weights[len]) {
+      r -= length_weights[len++];
+    }
+    return len;
+  }
+
+  vector<uint32_t> block_hop;
+  vector<RoutingTableEntry> prefixes;
+  std::unordered_set<uint64_t> used;
+};
+
+static uint32_t randomHost(const RoutingTableEntry &entry) {
+  return entry.addr | htonl(xorshift() & ~prefixMask(entry.len));
+}
+
+static void uniformStream(const vector<RoutingTableEntry> &table, vector<uint32_t> &addrs) {
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    addrs.push_back(randomHost(table[xorshift() % table.size()]));
+  }
+}
+
+static void zipfStream(const vector<RoutingTableEntry> &table, vector<uint32_t> &addrs) {
+  vector<uint32_t> dsts(N_ZIPF_DSTS);
+  vector<double> cdf(N_ZIPF_DSTS);
+  double sum = 0;
+  for (uint32_t i = 0; i < N_ZIPF_DSTS; i++) {
+    dsts[i] = randomHost(table[xorshift() % table.size()]);
+    sum += 1.0 / pow(i + 1, ZIPF_SKEW);
+    cdf[i] = sum;
+  }
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    double u = (double)xorshift() / 4294967296.0 * sum;
+    addrs.push_back(dsts[std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()]);
+  }
+}
+
+// destination addresses of the IPv4 packets in an ethernet capture of either byte order
+static bool readPcap(const char *path, vector<uint32_t> &trace) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t header[6];
+  bool swapped = fread(header, sizeof(header), 1, fp) == 1 && header[0] == 0xd4c3b2a1;
+  if (!swapped && header[0] != 0xa1b2c3d4) {
+    fclose(fp);
+    return false;
+  }
+  if ((swapped ? __builtin_bswap32(header[5]) : header[5]) != 1) {
+    fclose(fp);
+    return false;
+  }
+  uint32_t record[4];
+  uint8_t packet[65536];
+  while (fread(record, sizeof(record), 1, fp) == 1) {
+    uint32_t caplen = swapped ? __builtin_bswap32(record[2]) : record[2];
+    if (caplen > sizeof(packet) || fread(packet, 1, caplen, fp) != caplen) {
+      break;
+    }
+    // the router HAL tags every frame with the interface's VLAN
+    size_t type = packet[12] == 0x81 && packet[13] == 0x00 ? 16 : 12;
+    if (caplen >= type + 22 && packet[type] == 0x08 && packet[type + 1] == 0x00) {
+      uint32_t dst;
+      memcpy(&dst, &packet[type + 18], sizeof(dst));
+      trace.push_back(dst);
+    }
+  }
+  fclose(fp);
+  return true;
+}
+
+// TSC on x86, nanoseconds elsewhere
+static inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+static double ns_per_tick = 1;
+static uint64_t tick_overhead = 0;
+
+static void calibrate() {
+  auto begin = std::chrono::steady_clock::now();
+  uint64_t first = ticks();
+  while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(50)) {
+  }
+  uint64_t last = ticks();
+  ns_per_tick =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+      (last - first);
+  vector<uint64_t> empty(10001);
+  for (auto &t : empty) {
+    uint64_t t0 = ticks();
+    t = ticks() - t0;
+  }
+  std::nth_element(empty.begin(), empty.begin() + empty.size() / 2, empty.end());
+  tick_overhead = empty[empty.size() / 2];
+}
+
+static double seconds(std::chrono::steady_clock::time_point begin,
+                      std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+static long rssKb() {
+  FILE *fp = fopen("/proc/self/status", "r");
+  long kb = -1;
+  char line[256];
+  while (fp && fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+      break;
+    }
+  }
+  if (fp) {
+    fclose(fp);
+  }
+  return kb;
+}
+
+struct StreamResult {
+  const char *name;
+  double lookups_per_s;
+  double p50_ns;
+  double p99_ns;
+  double hit_rate; // query() cache, negative for the linear reference
+  uint32_t checked;
+  uint32_t mismatches;
+};
+
+static volatile uint32_t sink;
+
+static StreamResult measure(const char *name, QueryFn fn, const vector<uint32_t> &addrs,
+                            size_t count) {
+  StreamResult result = {name, 0, 0, 0, -1, 0, 0};
+  uint32_t nexthop, if_index, metric, sum = 0;
+  uint64_t hits, misses, saved, old_hits, old_misses;
+  queryCacheStats(&old_hits, &old_misses, &saved);
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    sum += fn(addrs[i], &nexthop, &if_index, &metric) ? nexthop : 1;
+  }
+  auto end = std::chrono::steady_clock::now();
+  result.lookups_per_s = count / seconds(begin, end);
+  if (fn == query) {
+    queryCacheStats(&hits, &misses, &saved);
+    result.hit_rate = (double)(hits - old_hits) / (hits - old_hits + misses - old_misses);
+  }
+
+  vector<uint64_t> latency(std::min<size_t>(count, N_TIMED));
+  for (size_t i = 0; i < latency.size(); i++) {
+    uint64_t t0 = ticks();
+    sum += fn(addrs[i], &nexthop, &if_index, &metric) ? nexthop : 1;
+    uint64_t t = ticks() - t0;
+    latency[i] = t > tick_overhead ? t - tick_overhead : 0;
+  }
+  sink = sum;
+  std::sort(latency.begin(), latency.end());
+  result.p50_ns = latency[latency.size() / 2] * ns_per_tick;
+  result.p99_ns = latency[latency.size() * 99 / 100] * ns_per_tick;
+  return result;
+}
+
+// compares query() with the linear reference on an evenly spread sample
+static void crossCheck(const vector<uint32_t> &addrs, size_t samples, StreamResult &result) {
+  size_t step = std::max<size_t>(1, addrs.size() / samples);
+  for (size_t i = 0; i < addrs.size() && result.checked < samples; i += step) {
+    uint32_t nexthop, if_index, metric = 0, ref_nexthop, ref_if_index, ref_metric = 0;
+    bool found = query(addrs[i], &nexthop, &if_index, &metric);
+    bool ref_found = linearQuery(addrs[i], &ref_nexthop, &ref_if_index, &ref_metric);
+    result.mismatches += found != ref_found ||
+                         (found && (nexthop != ref_nexthop || if_index != ref_if_index ||
+                                    metric != ref_metric));
+    result.checked++;
+  }
+}
+
+struct ChurnResult {
+  uint32_t updates;
+  double updates_per_s;
+  double lookups_per_s;
+  double linear_updates_per_s;
+  StreamResult check;
+};
+
+// withdrawals, new prefixes and next hop changes in equal parts, with lookups in between
+static ChurnResult churn(TableGenerator &generator, vector<RoutingTableEntry> &live,
+                         const vector<uint32_t> &addrs, size_t samples) {
+  ChurnResult result = {0, 0, 0, 0, {"churn", 0, 0, 0, -1, 0, 0}};
+  double update_s = 0, lookup_s = 0, linear_s = 0;
+  uint32_t nexthop, if_index, metric, sum = 0;
+  size_t cursor = 0;
+  vector<uint32_t> touched;
+  while (result.updates < N_CHURN && update_s < CHURN_SECONDS) {
+    uint32_t kind = xorshift() % 3;
+    bool insert = kind != 0 || live.empty();
+    RoutingTableEntry entry;
+    if (!insert) {
+      size_t i = xorshift() % live.size();
+      entry = live[i];
+      live[i] = live.back();
+      live.pop_back();
+    } else if (kind == 1 || live.empty()) {
+      entry = generator.next();
+      live.push_back(entry);
+    } else {
+      RoutingTableEntry &changed = live[xorshift() % live.size()];
+      uint32_t hop = xorshift() % N_NEIGHBOURS;
+      changed.nexthop = htonl(0x0a000001 + hop);
+      changed.if_index = hop % 4;
+      entry = changed;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    update(insert, entry, entry.if_index);
+    auto t1 = std::chrono::steady_clock::now();
+    linearUpdate(insert, entry, entry.if_index);
+    auto t2 = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOKUPS_PER_UPDATE; i++) {
+      sum += query(addrs[cursor], &nexthop, &if_index, &metric) ? nexthop : 1;
+      cursor = (cursor + 1) % addrs.size();
+    }
+    auto t3 = std::chrono::steady_clock::now();
+    update_s += seconds(t0, t1);
+    linear_s += seconds(t1, t2);
+    lookup_s += seconds(t2, t3);
+    touched.push_back(randomHost(entry));
+    result.updates++;
+  }
+  sink = sum;
+  result.updates_per_s = result.updates / update_s;
+  result.linear_updates_per_s = result.updates / linear_s;
+  result.lookups_per_s = (double)result.updates * LOOKUPS_PER_UPDATE / lookup_s;
+  // every changed prefix, then the rest of the sample from the uniform stream
+  crossCheck(touched, touched.size(), result.check);
+  crossCheck(addrs, samples, result.check);
+  return result;
+}
+
+static void printStreams(const vector<StreamResult> &streams) {
+  printf("\"streams\": {");
+  for (size_t i = 0; i < streams.size(); i++) {
+    const StreamResult &s = streams[i];
+    printf("%s\n      \"%s\": {\"lookups_per_s\": %.0f, \"p50_ns\": %.1f, \"p99_ns\": %.1f", i ? "," : "",
+           s.name, s.lookups_per_s, s.p50_ns, s.p99_ns);
+    if (s.hit_rate >= 0) {
+      printf(", \"cache_hit_rate\": %.4f", s.hit_rate);
+    }
+    if (s.checked) {
+      printf(", \"checked\": %u, \"mismatches\": %u", s.checked, s.mismatches);
+    }
+    printf("}");
+  }
+  printf("}");
+}
+
+static int evaluate(uint32_t n, const vector<uint32_t> &captured) {
+  calibrate();
+  TableGenerator generator;
+  vector<RoutingTableEntry> table;
+  for (uint32_t i = 0; i < n; i++) {
+    table.push_back(generator.next());
+  }
+  struct Stream {
+    const char *name;
+    vector<uint32_t> addrs;
+  };
+  vector<Stream> streams(2);
+  streams[0].name = "uniform";
+  uniformStream(table, streams[0].addrs);
+  streams[1].name = "zipf";
+  zipfStream(table, streams[1].addrs);
+  if (!captured.empty()) {
+    Stream trace;
+    trace.name = "trace";
+    while (trace.addrs.size() < N_LOOKUPS) {
+      trace.addrs.insert(trace.addrs.end(), captured.begin(), captured.end());
+    }
+    trace.addrs.resize(N_LOOKUPS);
+    streams.push_back(trace);
+  }
+
+  long rss_before = rssKb();
+  auto begin = std::chrono::steady_clock::now();
+  loadRoutes(table.data(), table.size());
+  double build_ms = seconds(begin, std::chrono::steady_clock::now()) * 1000;
+  long rss = rssKb();
+  linear_table = table;
+
+  size_t samples = std::min<size_t>(20000, std::max<size_t>(1000, LINEAR_BUDGET / n));
+  vector<StreamResult> results, linear;
+  for (const Stream &stream : streams) {
+    results.push_back(measure(stream.name, query, stream.addrs, N_LOOKUPS));
+    crossCheck(stream.addrs, samples, results.back());
+    if (n <= LINEAR_MAX_PREFIXES) {
+      size_t count = std::min<size_t>(N_LOOKUPS, LINEAR_BUDGET / n);
+      linear.push_back(measure(stream.name, linearQuery, stream.addrs, count));
+    }
+  }
+  vector<RoutingTableEntry> live = table;
+  ChurnResult churned = churn(generator, live, streams[0].addrs, samples);
+
+  uint32_t wrong = churned.check.mismatches;
+  for (const StreamResult &s : results) {
+    wrong += s.mismatches;
+  }
+  printf("    {\"engine\": \"%s\", \"prefixes\": %u, \"build_ms\": %.1f, \"rss_kb\": %ld, "
+         "\"table_kb\": %ld,\n     ",
+         ENGINE_NAME, n, build_ms, rss, rss - rss_before);
+  printStreams(results);
+  printf(",\n     \"churn\": {\"updates\": %u, \"updates_per_s\": %.1f, \"lookups_per_s\": %.0f, "
+         "\"checked\": %u, \"mismatches\": %u}}",
+         churned.updates, churned.updates_per_s, churned.lookups_per_s, churned.check.checked,
+         churned.check.mismatches);
+  if (!linear.empty()) {
+    printf(",\n    {\"engine\": \"linear\", \"prefixes\": %u,\n     ", n);
+    printStreams(linear);
+    printf(",\n     \"churn\": {\"updates\": %u, \"updates_per_s\": %.1f}}", churned.updates,
+           churned.linear_updates_per_s);
+  }
+  return wrong == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  vector<uint32_t> captured;
+  for (int i = 1; i < argc; i++) {
+    if (!readPcap(argv[i], captured)) {
+      fprintf(stderr, "cannot read %s\n", argv[i]);
+      return 1;
+    }
+  }
+  const uint32_t sizes[] = {1000, 10000, 100000, 1000000};
+  int failed = 0;
+  printf("{\"engine\": \"%s\", \"lookups\": %u, \"trace_addresses\": %zu, \"results\": [\n",
+         ENGINE_NAME, N_LOOKUPS, captured.size());
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    if (i) {
+      printf(",\n");
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      int result = evaluate(sizes[i], captured);
+      fflush(stdout);
+      _exit(result);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%u prefixes: FAILED\n", sizes[i]);
+      failed = 1;
+    }
+  }
+  printf("\n  ],\n  \"ok\": %s\n}\n", failed ? "false" : "true");
+  return failed;
+}
@@ -4,31 +4,47 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-extern void update(bool insert, RoutingTableEntry entry);
-extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+extern void update(bool insert, RoutingTableEntry entry, uint32_t if_index);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, uint32_t *metric);
+extern bool loadRouteFile(const char *path);
 char buffer[1024];
 
 int main(int argc, char *argv[]) {
-  uint32_t addr, len, if_index, nexthop;
+  uint32_t addr, len, if_index, nexthop, metric;
   char tmp;
+  char path[1024];
   while (fgets(buffer, sizeof(buffer), stdin)) {
     if (buffer[0] == 'I') {
       sscanf(buffer, "%c,%x,%d,%d,%x", &tmp, &addr, &len, &if_index, &nexthop);
-      RoutingTableEntry entry = {
-          .addr = addr, .len = len, .if_index = if_index, .nexthop = nexthop};
-      update(true, entry);
+      RoutingTableEntry entry = {.addr = addr,
+                                 .len = len,
+                                 .if_index = if_index,
+                                 .nexthop = nexthop,
+                                 .metric = 0,
+                                 .changed = false,
+                                 .timeout = NULL};
+      update(true, entry, 0);
     } else if (buffer[0] == 'D') {
       sscanf(buffer, "%c,%x,%d", &tmp, &addr, &len);
       RoutingTableEntry entry = {
         .addr = addr,
         .len = len,
         .if_index = 0,
-        .nexthop = 0
+        .nexthop = 0,
+        .metric = 0,
+        .changed = false,
+        .timeout = NULL
       };
-      update(false, entry);
+      // the lab deletes by prefix only
+      update(false, entry, ROUTE_ANY_INTERFACE);
+    } else if (buffer[0] == 'L') {
+      // L,<file>: bulk load a binary route file
+      if (sscanf(buffer, "%c,%1023s", &tmp, path) != 2 || !loadRouteFile(path)) {
+        printf("Load Failed\n");
+      }
     } else if (buffer[0] == 'Q') {
       sscanf(buffer, "%c,%x", &tmp, &addr);
-      if (query(addr, &nexthop, &if_index)) {
+      if (query(addr, &nexthop, &if_index, &metric)) {
         printf("0x%08x %d\n", nexthop, if_index);
       } else {
         printf("Not Found\n");
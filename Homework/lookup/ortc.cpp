@@ -0,0 +1,506 @@
+#include "ortc.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <iterator>
+#include <map>
+#include <stdint.h>
+#include <vector>
+using std::vector;
+
+#define ORTC_NONE 0xffffffffu // no RIB route / no FIB entry at this node
+#define ORTC_NULL 0           // hop id meaning "no route"
+// hop ids allowed on top of twice the live ones before the tables are compacted
+#define ORTC_HOP_SLACK 1024
+
+struct OrtcNode {
+  OrtcNode *child[2];
+  uint32_t route;        // hop id of the RIB route at this prefix
+  uint32_t metric;       // metric of that RIB route
+  uint32_t chosen;       // hop id of the FIB entry emitted at this prefix
+  uint32_t incoming;     // hop inherited from the FIB above at the last pass
+  bool dirty;            // set recomputed since the last pass
+  vector<uint32_t> set;  // pass 2 candidate hops, sorted
+};
+
+static OrtcNode *ortc_root;
+static vector<FibEntry> hops; // hop id -> forwarding info, hops[0] has no path
+static std::map<vector<uint32_t>, uint32_t> hop_ids;
+static uint32_t rib_prefixes;
+static uint32_t fib_prefixes;
+static bool ortc_batch; // choose() only records, ortcLoad() publishes the whole FIB
+// ortcUpdate() compacts the hop tables once they grow this large, see compactHops()
+static size_t hop_limit = ORTC_HOP_SLACK;
+
+// routes with the same key forward the same way and share a hop id
+static vector<uint32_t> hopKey(const FibEntry *entry) {
+  vector<uint32_t> key(entry->nexthop, entry->nexthop + entry->paths);
+  key.insert(key.end(), entry->if_index, entry->if_index + entry->paths);
+  return key;
+}
+
+static uint32_t hopId(const FibEntry *entry) {
+  if (hops.empty()) {
+    FibEntry none = {0, 0, {0}, {0}};
+    hops.push_back(none);
+  }
+  vector<uint32_t> key = hopKey(entry);
+  auto it = hop_ids.find(key);
+  if (it != hop_ids.end()) {
+    hops[it->second].metric = entry->metric;
+    return it->second;
+  }
+  uint32_t id = hops.size();
+  hops.push_back(*entry);
+  hop_ids[key] = id;
+  return id;
+}
+
+static inline void markHop(uint32_t id, vector<uint32_t> &remap) {
+  if (id != ORTC_NONE) {
+    remap[id] = 0;
+  }
+}
+
+static void markHops(const OrtcNode *node, vector<uint32_t> &remap) {
+  markHop(node->route, remap);
+  markHop(node->chosen, remap);
+  markHop(node->incoming, remap);
+  for (uint32_t id : node->set) {
+    markHop(id, remap);
+  }
+  if (node->child[0]) {
+    markHops(node->child[0], remap);
+    markHops(node->child[1], remap);
+  }
+}
+
+static inline void renumberHop(uint32_t &id, const vector<uint32_t> &remap) {
+  if (id != ORTC_NONE) {
+    id = remap[id];
+  }
+}
+
+static void renumberHops(OrtcNode *node, const vector<uint32_t> &remap) {
+  renumberHop(node->route, remap);
+  renumberHop(node->chosen, remap);
+  renumberHop(node->incoming, remap);
+  for (uint32_t &id : node->set) {
+    renumberHop(id, remap);
+  }
+  if (node->child[0]) {
+    renumberHops(node->child[0], remap);
+    renumberHops(node->child[1], remap);
+  }
+}
+
+// hopId() never forgets a hop, so this drops the ones nothing in the tree refers to any
+// more. The rest keep their order, sets stay sorted and ties in choose() still go the
+// same way, so the FIB does not change
+static void compactHops() {
+  if (hops.empty() || !ortc_root) {
+    return;
+  }
+  vector<uint32_t> remap(hops.size(), ORTC_NONE);
+  markHops(ortc_root, remap);
+  vector<FibEntry> live(1, hops[ORTC_NULL]);
+  hop_ids.clear();
+  for (uint32_t id = 1; id < hops.size(); id++) {
+    if (remap[id] != ORTC_NONE) {
+      remap[id] = live.size();
+      hop_ids[hopKey(&hops[id])] = live.size();
+      live.push_back(hops[id]);
+    }
+  }
+  remap[ORTC_NULL] = ORTC_NULL;
+  hops.swap(live);
+  renumberHops(ortc_root, remap);
+  hop_limit = std::max<size_t>(2 * hops.size(), ORTC_HOP_SLACK);
+}
+
+static OrtcNode *newNode() {
+  OrtcNode *node = new OrtcNode;
+  node->child[0] = node->child[1] = nullptr;
+  node->route = ORTC_NONE;
+  node->metric = 0;
+  node->chosen = ORTC_NONE;
+  node->incoming = ORTC_NONE;
+  node->dirty = true;
+  return node;
+}
+
+static inline uint32_t prefixMask(uint32_t len) {
+  return len ? 0xffffffffu << (32 - len) : 0;
+}
+
+static inline bool isFiller(const OrtcNode *node) {
+  return !node->child[0] && node->route == ORTC_NONE;
+}
+
+static FibEntry entryFor(const OrtcNode *node, uint32_t chosen) {
+  FibEntry entry = hops[chosen];
+  if (node->route == chosen) {
+    entry.metric = node->metric;
+  }
+  return entry;
+}
+
+static void emit(uint32_t prefix, uint32_t len, const OrtcNode *node,
+                 uint32_t chosen) {
+  if (ortc_batch) {
+    return;
+  }
+  if (chosen == ORTC_NONE) {
+    fib_prefixes--;
+    fibRemove(htonl(prefix), len);
+    return;
+  }
+  if (node->chosen == ORTC_NONE) {
+    fib_prefixes++;
+  }
+  FibEntry entry = entryFor(node, chosen);
+  fibInsert(htonl(prefix), len, &entry);
+}
+
+static void removeChild(OrtcNode *node, uint32_t prefix, uint32_t len, int bit) {
+  OrtcNode *child = node->child[bit];
+  if (child->chosen != ORTC_NONE) {
+    emit(prefix | ((uint32_t)bit << (31 - len)), len + 1, child, ORTC_NONE);
+  }
+  delete child;
+  node->child[bit] = nullptr;
+}
+
+static void combine(const vector<uint32_t> &a, const vector<uint32_t> &b,
+                    vector<uint32_t> &out) {
+  out.clear();
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(out));
+  if (out.empty()) {
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(out));
+  }
+}
+
+// pass 2 below node, children with their own route do not depend on inh
+// and are only revisited when all is set
+static void computeSets(OrtcNode *node, uint32_t inh, bool all) {
+  uint32_t here = node->route != ORTC_NONE ? node->route : inh;
+  node->dirty = true;
+  if (!node->child[0]) {
+    node->set.assign(1, here);
+    return;
+  }
+  for (int bit = 0; bit < 2; bit++) {
+    OrtcNode *child = node->child[bit];
+    if (all || child->route == ORTC_NONE || child->set.empty()) {
+      computeSets(child, here, all);
+    }
+  }
+  combine(node->child[0]->set, node->child[1]->set, node->set);
+}
+
+// a subtree at depth FIB_BUILD_SPLIT handled by one thread in ortcLoad()
+struct OrtcTask {
+  OrtcNode *node;
+  uint32_t prefix;
+  uint32_t len;
+  uint32_t inh; // route inherited in pass 2, FIB hop inherited in pass 3
+  vector<FibRoute> routes;
+};
+
+// pass 3, only descends where a set changed or the inherited hop differs;
+// with defer set, subtrees at depth FIB_BUILD_SPLIT are left to the caller
+static void choose(OrtcNode *node, uint32_t prefix, uint32_t len, uint32_t cur,
+                   vector<OrtcTask> *defer) {
+  if (!node->dirty && node->incoming == cur) {
+    return;
+  }
+  if (defer && len == FIB_BUILD_SPLIT) {
+    OrtcTask task = {node, prefix, len, cur, vector<FibRoute>()};
+    defer->push_back(task);
+    return;
+  }
+  node->dirty = false;
+  node->incoming = cur;
+  uint32_t chosen = std::binary_search(node->set.begin(), node->set.end(), cur)
+                        ? ORTC_NONE
+                        : node->set[0];
+  if (chosen != node->chosen) {
+    emit(prefix, len, node, chosen);
+    node->chosen = chosen;
+  }
+  if (node->child[0]) {
+    uint32_t down = chosen != ORTC_NONE ? chosen : cur;
+    choose(node->child[0], prefix, len + 1, down, defer);
+    choose(node->child[1], prefix | (1u << (31 - len)), len + 1, down, defer);
+  }
+}
+
+// the body of ortcUpdate(), its FIB changes go into the caller's batch
+static void updatePrefix(uint32_t addr, uint32_t len, const FibEntry *entry) {
+  if (!ortc_root) {
+    ortc_root = newNode();
+  }
+  uint32_t key = ntohl(addr) & prefixMask(len);
+  OrtcNode *path[33];
+  path[0] = ortc_root;
+  for (uint32_t depth = 0; depth < len; depth++) {
+    OrtcNode *node = path[depth];
+    if (!node->child[0]) {
+      if (!entry) {
+        return;
+      }
+      node->child[0] = newNode();
+      node->child[1] = newNode();
+    }
+    path[depth + 1] = node->child[(key >> (31 - depth)) & 1];
+  }
+
+  OrtcNode *target = path[len];
+  uint32_t route = entry ? hopId(entry) : ORTC_NONE;
+  if (target->route == route) {
+    if (entry && target->metric != entry->metric) {
+      target->metric = entry->metric;
+      if (target->chosen == route) {
+        emit(key, len, target, route);
+      }
+    }
+    return;
+  }
+  if (target->route == ORTC_NONE) {
+    rib_prefixes++;
+  } else if (route == ORTC_NONE) {
+    rib_prefixes--;
+  }
+  target->route = route;
+  target->metric = entry ? entry->metric : 0;
+
+  // collapse filler leaves left behind by a removal
+  int top = len;
+  for (int depth = len; depth >= 0; depth--) {
+    OrtcNode *node = path[depth];
+    if (!node->child[0]) {
+      top = depth;
+      continue;
+    }
+    if (!isFiller(node->child[0]) || !isFiller(node->child[1])) {
+      break;
+    }
+    uint32_t prefix = key & prefixMask(depth);
+    removeChild(node, prefix, depth, 0);
+    removeChild(node, prefix, depth, 1);
+    top = depth;
+  }
+
+  uint32_t inh[33];
+  inh[0] = ORTC_NULL;
+  for (int depth = 0; depth < top; depth++) {
+    inh[depth + 1] = path[depth]->route != ORTC_NONE ? path[depth]->route : inh[depth];
+  }
+  computeSets(path[top], inh[top], false);
+  for (int depth = top - 1; depth >= 0; depth--) {
+    OrtcNode *node = path[depth];
+    uint32_t here = node->route != ORTC_NONE ? node->route : inh[depth];
+    OrtcNode *sibling = node->child[((key >> (31 - depth)) & 1) ^ 1];
+    if (sibling->set.empty()) {
+      computeSets(sibling, here, false);
+    }
+    node->dirty = true;
+    combine(node->child[0]->set, node->child[1]->set, node->set);
+  }
+  choose(ortc_root, 0, 0, ORTC_NULL, nullptr);
+}
+
+void ortcUpdate(uint32_t addr, uint32_t len, const FibEntry *entry) {
+  // re-aggregating removes, inserts and replaces several prefixes, readers must only
+  // see the FIB before and after all of them
+  bool own_batch = !fibInBatch();
+  if (own_batch) {
+    fibBegin();
+  }
+  updatePrefix(addr, len, entry);
+  if (own_batch) {
+    fibCommit();
+  }
+  // amortized over at least as many new hops as survive, the tree walk is cheap per update
+  if (hops.size() >= hop_limit) {
+    compactHops();
+  }
+}
+
+static void collect(const OrtcNode *node, uint32_t prefix, uint32_t len,
+                    vector<FibRoute> &out) {
+  if (node->chosen != ORTC_NONE) {
+    FibRoute route = {htonl(prefix), len, entryFor(node, node->chosen)};
+    out.push_back(route);
+  }
+  if (node->child[0]) {
+    collect(node->child[0], prefix, len + 1, out);
+    collect(node->child[1], prefix | (1u << (31 - len)), len + 1, out);
+  }
+}
+
+// pass 2 above depth FIB_BUILD_SPLIT, the subtrees below are left in tasks
+static void splitSets(OrtcNode *node, uint32_t len, uint32_t inh,
+                      vector<OrtcTask> &tasks) {
+  if (len == FIB_BUILD_SPLIT || !node->child[0]) {
+    OrtcTask task = {node, 0, len, inh, vector<FibRoute>()};
+    tasks.push_back(task);
+    return;
+  }
+  uint32_t here = node->route != ORTC_NONE ? node->route : inh;
+  node->dirty = true;
+  splitSets(node->child[0], len + 1, here, tasks);
+  splitSets(node->child[1], len + 1, here, tasks);
+}
+
+static void joinSets(OrtcNode *node, uint32_t len) {
+  if (len == FIB_BUILD_SPLIT || !node->child[0]) {
+    return;
+  }
+  joinSets(node->child[0], len + 1);
+  joinSets(node->child[1], len + 1);
+  combine(node->child[0]->set, node->child[1]->set, node->set);
+}
+
+static void setsTask(void *arg, size_t index) {
+  OrtcTask &task = (*(vector<OrtcTask> *)arg)[index];
+  computeSets(task.node, task.inh, true);
+}
+
+static void chooseTask(void *arg, size_t index) {
+  OrtcTask &task = (*(vector<OrtcTask> *)arg)[index];
+  choose(task.node, task.prefix, task.len, task.inh, nullptr);
+  collect(task.node, task.prefix, task.len, task.routes);
+}
+
+// same preorder as collect(), splicing in the subtrees collected by the tasks
+static void joinRoutes(const OrtcNode *node, uint32_t prefix, uint32_t len,
+                       vector<OrtcTask> &tasks, size_t &next, vector<FibRoute> &out) {
+  if (len == FIB_BUILD_SPLIT) {
+    out.insert(out.end(), tasks[next].routes.begin(), tasks[next].routes.end());
+    next++;
+    return;
+  }
+  if (node->chosen != ORTC_NONE) {
+    FibRoute route = {htonl(prefix), len, entryFor(node, node->chosen)};
+    out.push_back(route);
+  }
+  if (node->child[0]) {
+    joinRoutes(node->child[0], prefix, len + 1, tasks, next, out);
+    joinRoutes(node->child[1], prefix | (1u << (31 - len)), len + 1, tasks, next, out);
+  }
+}
+
+// routes order[first, last) all lie below node, at depth FIB_BUILD_SPLIT
+struct InsertTask {
+  OrtcNode *node;
+  size_t first;
+  size_t last;
+  uint32_t added; // prefixes that were not in the RIB before
+};
+
+struct InsertJob {
+  const FibRoute *routes;
+  vector<size_t> order;
+  vector<uint32_t> ids;
+  vector<InsertTask> tasks;
+};
+
+// walks down from node at depth, returns whether the prefix is new
+static bool insertRoute(OrtcNode *node, uint32_t depth, const FibRoute &route,
+                        uint32_t id) {
+  uint32_t key = ntohl(route.addr);
+  for (; depth < route.len; depth++) {
+    if (!node->child[0]) {
+      node->child[0] = newNode();
+      node->child[1] = newNode();
+    }
+    node = node->child[(key >> (31 - depth)) & 1];
+  }
+  bool added = node->route == ORTC_NONE;
+  node->route = id;
+  node->metric = route.entry.metric;
+  return added;
+}
+
+static void insertTask(void *arg, size_t index) {
+  InsertJob &job = *(InsertJob *)arg;
+  InsertTask &task = job.tasks[index];
+  for (size_t i = task.first; i < task.last; i++) {
+    size_t route = job.order[i];
+    task.added += insertRoute(task.node, FIB_BUILD_SPLIT, job.routes[route], job.ids[route]);
+  }
+}
+
+void ortcLoad(const FibRoute *routes, size_t count) {
+  if (!ortc_root) {
+    ortc_root = newNode();
+  }
+  compactHops();
+  // sorted, the walks down the trie stay in cache and each subtree gets a contiguous range;
+  // the sort is stable so the last of duplicate prefixes still wins
+  InsertJob job;
+  job.routes = routes;
+  job.order.resize(count);
+  job.ids.resize(count);
+  vector<uint32_t> keys(count);
+  for (size_t i = 0; i < count; i++) {
+    job.order[i] = i;
+    keys[i] = ntohl(routes[i].addr) & prefixMask(routes[i].len);
+    job.ids[i] = hopId(&routes[i].entry);
+  }
+  std::stable_sort(job.order.begin(), job.order.end(), [&](size_t a, size_t b) {
+    return keys[a] != keys[b] ? keys[a] < keys[b] : routes[a].len < routes[b].len;
+  });
+
+  // prefixes above the split go in directly, the rest by subtree in parallel
+  for (size_t i = 0; i < count; i++) {
+    const FibRoute &route = routes[job.order[i]];
+    if (route.len < FIB_BUILD_SPLIT) {
+      rib_prefixes += insertRoute(ortc_root, 0, route, job.ids[job.order[i]]);
+      continue;
+    }
+    uint32_t top = keys[job.order[i]] >> (32 - FIB_BUILD_SPLIT);
+    if (job.tasks.empty() || keys[job.order[job.tasks.back().first]] >> (32 - FIB_BUILD_SPLIT) != top) {
+      OrtcNode *node = ortc_root;
+      for (uint32_t depth = 0; depth < FIB_BUILD_SPLIT; depth++) {
+        if (!node->child[0]) {
+          node->child[0] = newNode();
+          node->child[1] = newNode();
+        }
+        node = node->child[(top >> (FIB_BUILD_SPLIT - 1 - depth)) & 1];
+      }
+      InsertTask task = {node, i, i, 0};
+      job.tasks.push_back(task);
+    }
+    job.tasks.back().last = i + 1;
+  }
+  fibParallelFor(job.tasks.size(), insertTask, &job);
+  for (const InsertTask &task : job.tasks) {
+    rib_prefixes += task.added;
+  }
+
+  // both passes over the whole tree, the subtrees below FIB_BUILD_SPLIT in parallel
+  vector<OrtcTask> tasks;
+  splitSets(ortc_root, 0, ORTC_NULL, tasks);
+  fibParallelFor(tasks.size(), setsTask, &tasks);
+  joinSets(ortc_root, 0);
+  tasks.clear();
+  ortc_batch = true;
+  choose(ortc_root, 0, 0, ORTC_NULL, &tasks);
+  fibParallelFor(tasks.size(), chooseTask, &tasks);
+  ortc_batch = false;
+
+  // preorder is sorted by address and length, as fibReplace() wants
+  vector<FibRoute> fib;
+  size_t next = 0;
+  joinRoutes(ortc_root, 0, 0, tasks, next, fib);
+  fib_prefixes = fib.size();
+  fibReplace(fib.data(), fib.size());
+}
+
+void ortcStats(uint32_t *rib, uint32_t *fib) {
+  *rib = rib_prefixes;
+  *fib = fib_prefixes;
+}
@@ -0,0 +1,42 @@
+#ifndef __ORTC_H__
+#define __ORTC_H__
+
+#include "fib.h"
+#include <stdint.h>
+
+/*
+  用 ORTC（Optimal Routing Table Constructor）算法把 RIB 压缩成一个等价且前缀数最少的 FIB。
+  RIB 保存在一棵规整化的二叉树中（每个节点有零个或两个孩子），每个节点缓存 ORTC
+  第二遍算出的下一跳集合和第三遍的选择。更新一个前缀时只重算它影响到的子树和到根的路径，
+  再把 FIB 中发生变化的前缀插入或删除。
+  判断两条路由能否合并只看转发信息（等价路径的 nexthop 和 if_index），不看 metric，
+  所以聚合后 FIB 中的 metric 只有参考意义，控制面应当查 RIB。
+  某些位置需要显式的“无路由”时，会在 FIB 中插入 paths 为 0 的表项，查询时视为没查到。
+*/
+
+/**
+ * @brief 更新 RIB 中的一个前缀，并把聚合结果的变化同步到 FIB；
+ *        调用者没有打开 fibBegin() 时自己开一批，读者只会看到更新前后的 FIB
+ * @param addr 前缀地址，大端序
+ * @param len 前缀长度
+ * @param entry 前缀的转发信息，为 NULL 表示删除这个前缀
+ */
+void ortcUpdate(uint32_t addr, uint32_t len, const FibEntry *entry);
+
+/**
+ * @brief 批量插入 RIB 前缀：先把所有前缀放进树中，再完整地做一遍 ORTC ，
+ *        最后用 fibReplace() 一次性发布整个 FIB；开始前会回收已经没有路由使用的下一跳编号，
+ *        ortcUpdate() 则在编号数翻倍后回收一次
+ * @param routes 要插入的前缀，addr 为大端序，不要求有序
+ * @param count 前缀个数
+ */
+void ortcLoad(const FibRoute *routes, size_t count);
+
+/**
+ * @brief 读取聚合前后的前缀数
+ * @param rib_prefixes RIB 中的前缀数
+ * @param fib_prefixes 聚合后 FIB 中的前缀数
+ */
+void ortcStats(uint32_t *rib_prefixes, uint32_t *fib_prefixes);
+
+#endif
@@ -0,0 +1,115 @@
+#include "fib.h"
+#include "ortc.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+using std::vector;
+
+// 评估 ORTC 聚合：生成类似真实路由表的 RIB（BGP 式的前缀长度分布，少量邻居，
+// 相邻地址块倾向于走同一个下一跳），比较聚合前后 FIB 的前缀数和查询耗时，
+// 并检查两者的查询结果完全一致
+
+#define N_NEIGHBOURS 8
+#define N_LOOKUPS 2000000
+
+typedef struct {
+  uint32_t addr; // 小端序
+  uint32_t len;
+  uint32_t hop;
+} Route;
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static FibEntry hopEntry(uint32_t hop) {
+  FibEntry entry = {htonl(1), 1, {htonl(0x0a000001 + hop)}, {hop % 4}};
+  return entry;
+}
+
+static void makeTable(uint32_t n, vector<Route> &routes) {
+  // each /12 block has a preferred exit, most prefixes in it follow it
+  vector<uint32_t> block_hop(1 << 12);
+  for (auto &hop : block_hop) {
+    hop = xorshift() % N_NEIGHBOURS;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t r = xorshift() % 100;
+    uint32_t len = r < 55 ? 24 : r < 70 ? 22 + r % 2 : r < 88 ? 16 + r % 6 : 8 + r % 8;
+    uint32_t addr = xorshift() & ~(0xffffffffu >> len);
+    uint32_t hop = xorshift() % 100 < 85 ? block_hop[addr >> 20] : xorshift() % N_NEIGHBOURS;
+    Route route = {addr, len, hop};
+    routes.push_back(route);
+  }
+}
+
+static double lookupNs(const vector<uint32_t> &addrs, vector<uint32_t> &result) {
+  FibEntry entry;
+  result.resize(addrs.size());
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < addrs.size(); i++) {
+    result[i] = fibLookup(addrs[i], &entry) ? entry.nexthop[0] : 0;
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() / addrs.size();
+}
+
+static void evaluate(uint32_t n) {
+  vector<Route> routes;
+  makeTable(n, routes);
+  vector<uint32_t> addrs;
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    const Route &route = routes[xorshift() % routes.size()];
+    addrs.push_back(htonl(route.addr | (xorshift() & (0xffffffffu >> route.len))));
+  }
+
+  // plain FIB, one entry per RIB prefix
+  for (const Route &route : routes) {
+    FibEntry entry = hopEntry(route.hop);
+    fibInsert(htonl(route.addr), route.len, &entry);
+  }
+  vector<uint32_t> plain, aggregated;
+  double plain_ns = lookupNs(addrs, plain);
+  for (const Route &route : routes) {
+    fibRemove(htonl(route.addr), route.len);
+  }
+
+  // aggregated FIB, built incrementally
+  auto begin = std::chrono::steady_clock::now();
+  for (const Route &route : routes) {
+    FibEntry entry = hopEntry(route.hop);
+    ortcUpdate(htonl(route.addr), route.len, &entry);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double update_us = std::chrono::duration<double, std::micro>(end - begin).count() / n;
+  uint32_t rib_prefixes, fib_prefixes;
+  ortcStats(&rib_prefixes, &fib_prefixes);
+  double aggregated_ns = lookupNs(addrs, aggregated);
+
+  uint32_t mismatches = 0;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    mismatches += plain[i] != aggregated[i];
+  }
+  printf("%7u routes: rib %7u prefixes, fib %7u prefixes (%5.1f%%), "
+         "lookup %6.1f ns -> %6.1f ns, %5.2f us/update, %u mismatches\n",
+         n, rib_prefixes, fib_prefixes, fib_prefixes * 100.0 / rib_prefixes,
+         plain_ns, aggregated_ns, update_us, mismatches);
+
+  for (const Route &route : routes) {
+    ortcUpdate(htonl(route.addr), route.len, NULL);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const uint32_t sizes[] = {10000, 100000, 500000};
+  for (uint32_t n : sizes) {
+    evaluate(n);
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "fib.h"
+#include "ortc.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+using std::vector;
+
+// 8 个读者线程不停查询，同时 1 个写者线程用 ortcUpdate() 不断修改路由，一半的修改在 fibBegin() 和 fibCommit() 之间成批发布。
+// 每条稳定的 /21 都有一个被修改的兄弟前缀，兄弟的变化会让 ORTC 重新聚合它们上面的前缀，
+// 但稳定前缀覆盖的地址在 RIB 中始终不变，读者任何时候都必须查到同一个下一跳
+
+#define N_READERS 8
+#define N_PAIRS 4096 // sibling /21s in 10.0.0.0/8
+#define N_HOPS 4
+#define RUN_MS 1000
+
+static std::atomic<bool> running;
+static std::atomic<uint64_t> lookups;
+static std::atomic<uint64_t> errors;
+
+static uint32_t xorshift(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// the even /21 of each pair is stable, the odd one is churned
+static uint32_t pairAddr(uint32_t pair, uint32_t odd) {
+  return htonl(0x0a000000 | pair << 12 | odd << 11);
+}
+
+static uint32_t stableHop(uint32_t pair) { return pair % N_HOPS; }
+
+static FibEntry hopEntry(uint32_t hop) {
+  FibEntry entry = {htonl(1), 1, {htonl(0xc0a80001 + hop)}, {hop}};
+  return entry;
+}
+
+static void reader(uint32_t seed) {
+  uint32_t state = seed;
+  uint64_t count = 0;
+  FibEntry entry;
+  while (running.load(std::memory_order_relaxed)) {
+    for (int i = 0; i < 256; i++) {
+      uint32_t r = xorshift(state);
+      uint32_t pair = r % N_PAIRS;
+      uint32_t addr = pairAddr(pair, 0) | htonl((r >> 12) & 0x7ff);
+      uint32_t hop = stableHop(pair);
+      if (!fibLookup(addr, &entry) || entry.paths != 1 || entry.if_index[0] != hop ||
+          entry.nexthop[0] != htonl(0xc0a80001 + hop)) {
+        errors++;
+      }
+    }
+    count += 256;
+  }
+  lookups += count;
+}
+
+static uint64_t writer() {
+  uint32_t state = 0x12345678;
+  uint64_t count = 0;
+  auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(RUN_MS);
+  while (std::chrono::steady_clock::now() < end) {
+    // every other group of 25 updates is one batch, like a RIP response
+    bool batch = (count / 25) & 1;
+    if (batch) {
+      fibBegin();
+    }
+    for (int i = 0; i < 25; i++) {
+      uint32_t pair = xorshift(state) % N_PAIRS;
+      uint32_t hop = xorshift(state) % (N_HOPS + 1);
+      if (hop == N_HOPS) {
+        ortcUpdate(pairAddr(pair, 1), 21, NULL);
+      } else {
+        // the stable hop merges the pair into a /20, any other splits it again
+        FibEntry entry = hopEntry(hop);
+        ortcUpdate(pairAddr(pair, 1), 21, &entry);
+      }
+      count++;
+    }
+    if (batch) {
+      fibCommit();
+    }
+  }
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  vector<FibRoute> routes;
+  for (uint32_t pair = 0; pair < N_PAIRS; pair++) {
+    FibRoute route = {pairAddr(pair, 0), 21, hopEntry(stableHop(pair))};
+    routes.push_back(route);
+  }
+  ortcLoad(routes.data(), routes.size());
+
+  running = true;
+  vector<std::thread> threads;
+  for (int i = 0; i < N_READERS; i++) {
+    threads.push_back(std::thread(reader, 0x9e3779b9u * (i + 1)));
+  }
+  uint64_t updates = writer();
+  running = false;
+  for (auto &t : threads) {
+    t.join();
+  }
+  uint32_t rib_prefixes, fib_prefixes;
+  ortcStats(&rib_prefixes, &fib_prefixes);
+  printf("writer: %llu updates, readers: %llu lookups\n", (unsigned long long)updates,
+         (unsigned long long)lookups.load());
+  printf("fib %u prefixes aggregated from %u routes\n", fib_prefixes, rib_prefixes);
+  if (errors.load()) {
+    printf("FAILED: %llu wrong lookups of unchanged routes\n", (unsigned long long)errors.load());
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,437 @@
+#include "range.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+using std::vector;
+
+#define RANGE_NONE 0xffffffffu // no prefix covers the interval
+// prefetch 4 levels ahead, the 16 descendants there share one cache line
+#define RANGE_PREFETCH 16
+// forwarding info is kept in chunks, a publish only copies the chunks that changed
+#define RANGE_CHUNK 1024
+// intervals per segment, an update only lays out again the segments around it
+#define RANGE_SEGMENT 1024
+
+struct RangeChunk {
+  FibEntry entries[RANGE_CHUNK];
+};
+
+// an Eytzinger search over sorted starts, keys and before are 1-based in Eytzinger order
+struct RangeIndex {
+  uint32_t count;   // starts except the first one, which the caller already knows is below
+  uint32_t last;    // value of the last interval
+  uint32_t *keys;   // interval starts, 64-byte aligned
+  uint32_t *before; // value of the interval ending just below keys[k]
+};
+
+// a run of consecutive intervals, never modified once created
+struct RangeSegment {
+  RangeIndex index;        // value is the prefix id
+  vector<uint32_t> starts; // sorted, for the writer
+  vector<uint32_t> owners;
+};
+
+// published tables are never modified, they share the segments and chunks that did not change
+struct RangeTable {
+  RangeIndex top;          // over the first start of each segment, value is the segment
+  const RangeSegment **segments;
+  uint32_t segment_count;
+  uint32_t intervals;
+  const RangeChunk **chunks; // prefix id -> forwarding info
+  uint32_t chunk_count;
+};
+
+// everything below is only touched with range_writer held
+static std::mutex range_writer;
+static std::map<uint64_t, uint32_t> prefixes; // start << 6 | len -> prefix id
+static vector<RangeChunk *> chunks;       // prefix id -> forwarding info
+static vector<bool> chunk_published;      // seen by readers, copy before writing
+static vector<RangeChunk *> chunk_garbage; // replaced, freed after the next publish
+static uint32_t next_id;
+static vector<uint32_t> free_ids;
+static vector<RangeSegment *> segments;       // in address order, the first starts at 0
+static vector<uint32_t> segment_starts;       // first interval start of each segment
+static vector<bool> segment_published;        // seen by readers, freed only after a publish
+static vector<RangeSegment *> segment_garbage; // replaced, freed after the next publish
+static uint32_t intervals;
+// an open write batch, see rangeBegin(); only the thread that opened it writes meanwhile
+static bool range_batch = false;
+static bool range_dirty;
+
+static std::atomic<const RangeTable *> range_table(nullptr);
+static std::atomic<uint64_t> range_generation(1);
+
+static inline uint32_t prefixMask(uint32_t len) {
+  return len ? 0xffffffffu << (32 - len) : 0;
+}
+
+static inline uint32_t prefixEnd(uint32_t start, uint32_t len) {
+  return len == 32 ? start : start | (0xffffffffu >> len);
+}
+
+// ordered by start, then length, which is the preorder of the prefix tree
+static inline uint64_t prefixKey(uint32_t start, uint32_t len) {
+  return (uint64_t)start << 6 | len;
+}
+
+static void setEntry(uint32_t id, const FibEntry *entry) {
+  size_t chunk = id / RANGE_CHUNK;
+  if (chunk == chunks.size()) {
+    chunks.push_back(new RangeChunk);
+    chunk_published.push_back(false);
+  }
+  if (chunk_published[chunk]) {
+    chunk_garbage.push_back(chunks[chunk]);
+    chunks[chunk] = new RangeChunk(*chunks[chunk]);
+    chunk_published[chunk] = false;
+  }
+  chunks[chunk]->entries[id % RANGE_CHUNK] = *entry;
+}
+
+static uint32_t allocId(const FibEntry *entry) {
+  uint32_t id;
+  if (free_ids.empty()) {
+    id = next_id++;
+  } else {
+    id = free_ids.back();
+    free_ids.pop_back();
+  }
+  setEntry(id, entry);
+  return id;
+}
+
+// appends an interval, keeping adjacent intervals owned by different prefixes
+static void emitInterval(vector<uint32_t> &s, vector<uint32_t> &o, uint32_t start,
+                         uint32_t owner) {
+  if (!s.empty() && s.back() == start) {
+    s.pop_back();
+    o.pop_back();
+  }
+  if (!o.empty() && o.back() == owner) {
+    return;
+  }
+  s.push_back(start);
+  o.push_back(owner);
+}
+
+// appends the intervals of [lo, hi], base owns whatever no prefix inside it covers
+static void flatten(uint32_t lo, uint32_t hi, uint32_t base, vector<uint32_t> &s,
+                    vector<uint32_t> &o) {
+  struct Open {
+    uint32_t end;
+    uint32_t id;
+  };
+  vector<Open> open;
+  emitInterval(s, o, lo, base);
+  for (auto it = prefixes.lower_bound(prefixKey(lo, 0));
+       it != prefixes.end() && (it->first >> 6) <= hi; it++) {
+    uint32_t start = it->first >> 6;
+    uint32_t end = prefixEnd(start, it->first & 63);
+    if (end > hi) {
+      // covers all of [lo, hi], already accounted for in base
+      continue;
+    }
+    while (!open.empty() && open.back().end < start) {
+      uint32_t end = open.back().end;
+      open.pop_back();
+      emitInterval(s, o, end + 1, open.empty() ? base : open.back().id);
+    }
+    emitInterval(s, o, start, it->second);
+    Open prefix = {end, it->second};
+    open.push_back(prefix);
+  }
+  while (!open.empty()) {
+    uint32_t end = open.back().end;
+    open.pop_back();
+    if (end != hi) {
+      emitInterval(s, o, end + 1, open.empty() ? base : open.back().id);
+    }
+  }
+}
+
+static void fillIndex(RangeIndex *index, const uint32_t *starts, const uint32_t *values,
+                      size_t &i, size_t k) {
+  if (k > index->count) {
+    return;
+  }
+  fillIndex(index, starts, values, i, 2 * k);
+  index->keys[k] = starts[i + 1];
+  index->before[k] = values[i];
+  i++;
+  fillIndex(index, starts, values, i, 2 * k + 1);
+}
+
+static void buildIndex(RangeIndex *index, const uint32_t *starts, const uint32_t *values,
+                       size_t count) {
+  index->count = count - 1;
+  index->last = values[count - 1];
+  size_t key_bytes = (count * sizeof(uint32_t) + 63) & ~(size_t)63;
+  index->keys = (uint32_t *)aligned_alloc(64, key_bytes);
+  index->before = (uint32_t *)malloc(count * sizeof(uint32_t));
+  size_t i = 0;
+  fillIndex(index, starts, values, i, 1);
+}
+
+static size_t indexBytes(const RangeIndex *index) {
+  return (((index->count + 1) * sizeof(uint32_t) + 63) & ~(size_t)63) +
+         (index->count + 1) * sizeof(uint32_t);
+}
+
+static void freeIndex(RangeIndex *index) {
+  free(index->keys);
+  free(index->before);
+}
+
+// the value of the last interval starting at or below key, which must not be below
+// the first start
+static inline uint32_t searchIndex(const RangeIndex *index, uint32_t key) {
+  const uint32_t *keys = index->keys;
+  size_t k = 1;
+  while (k <= index->count) {
+    __builtin_prefetch(keys + RANGE_PREFETCH * k);
+    k = 2 * k + (keys[k] <= key);
+  }
+  // undo the trailing right turns, k is then the first start above key
+  k >>= __builtin_ffsll(~(unsigned long long)k);
+  return k ? index->before[k] : index->last;
+}
+
+static RangeSegment *newSegment(const uint32_t *starts, const uint32_t *owners,
+                                size_t count) {
+  RangeSegment *segment = new RangeSegment;
+  segment->starts.assign(starts, starts + count);
+  segment->owners.assign(owners, owners + count);
+  buildIndex(&segment->index, starts, owners, count);
+  return segment;
+}
+
+static void freeSegment(void *ptr) {
+  RangeSegment *segment = (RangeSegment *)ptr;
+  freeIndex(&segment->index);
+  delete segment;
+}
+
+static void freeTable(void *ptr) {
+  RangeTable *table = (RangeTable *)ptr;
+  freeIndex(&table->top);
+  delete[] table->segments;
+  delete[] table->chunks;
+  delete table;
+}
+
+static void freeChunk(void *ptr) { delete (RangeChunk *)ptr; }
+
+// replaces segments [first, last) with the intervals s and o, cut into even segments of
+// at most RANGE_SEGMENT intervals
+static void spliceSegments(size_t first, size_t last, const vector<uint32_t> &s,
+                           const vector<uint32_t> &o) {
+  for (size_t i = first; i < last; i++) {
+    intervals -= segments[i]->starts.size();
+    if (segment_published[i]) {
+      segment_garbage.push_back(segments[i]);
+    } else {
+      freeSegment(segments[i]);
+    }
+  }
+  size_t pieces = (s.size() + RANGE_SEGMENT - 1) / RANGE_SEGMENT;
+  vector<RangeSegment *> created;
+  vector<uint32_t> created_starts;
+  for (size_t p = 0; p < pieces; p++) {
+    size_t begin = s.size() * p / pieces;
+    size_t end = s.size() * (p + 1) / pieces;
+    created.push_back(newSegment(&s[begin], &o[begin], end - begin));
+    created_starts.push_back(s[begin]);
+  }
+  intervals += s.size();
+  segments.erase(segments.begin() + first, segments.begin() + last);
+  segments.insert(segments.begin() + first, created.begin(), created.end());
+  segment_starts.erase(segment_starts.begin() + first, segment_starts.begin() + last);
+  segment_starts.insert(segment_starts.begin() + first, created_starts.begin(),
+                        created_starts.end());
+  segment_published.erase(segment_published.begin() + first,
+                          segment_published.begin() + last);
+  segment_published.insert(segment_published.begin() + first, pieces, false);
+}
+
+static void publish() {
+  RangeTable *table = new RangeTable;
+  vector<uint32_t> ids(segments.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    ids[i] = i;
+  }
+  buildIndex(&table->top, segment_starts.data(), ids.data(), ids.size());
+  table->segment_count = segments.size();
+  table->segments = new const RangeSegment *[segments.size()];
+  std::copy(segments.begin(), segments.end(), table->segments);
+  table->intervals = intervals;
+  table->chunk_count = chunks.size();
+  table->chunks = new const RangeChunk *[chunks.size()];
+  std::copy(chunks.begin(), chunks.end(), table->chunks);
+  const RangeTable *old = range_table.exchange(table);
+  range_generation++;
+  if (old) {
+    fibDefer(freeTable, (void *)old);
+  }
+  for (RangeChunk *chunk : chunk_garbage) {
+    fibDefer(freeChunk, chunk);
+  }
+  chunk_garbage.clear();
+  chunk_published.assign(chunks.size(), true);
+  for (RangeSegment *segment : segment_garbage) {
+    fibDefer(freeSegment, segment);
+  }
+  segment_garbage.clear();
+  segment_published.assign(segments.size(), true);
+}
+
+// publishes now, or leaves it to rangeCommit() while a batch is open
+static void publishOrDefer() {
+  if (range_batch) {
+    range_dirty = true;
+  } else {
+    publish();
+  }
+}
+
+void rangeUpdate(uint32_t addr, uint32_t len, const FibEntry *entry) {
+  std::unique_lock<std::mutex> lock(range_writer, std::defer_lock);
+  if (!range_batch) {
+    lock.lock();
+  }
+  if (segments.empty()) {
+    vector<uint32_t> s(1, 0), o(1, RANGE_NONE);
+    spliceSegments(0, 0, s, o);
+  }
+  uint32_t lo = ntohl(addr) & prefixMask(len);
+  uint32_t hi = prefixEnd(lo, len);
+  auto it = prefixes.find(prefixKey(lo, len));
+  if (entry && it != prefixes.end()) {
+    // same intervals, only the forwarding info changes
+    setEntry(it->second, entry);
+    publishOrDefer();
+    return;
+  }
+  if (entry) {
+    prefixes[prefixKey(lo, len)] = allocId(entry);
+  } else if (it != prefixes.end()) {
+    free_ids.push_back(it->second);
+    prefixes.erase(it);
+  } else {
+    return;
+  }
+
+  // the longest prefix strictly covering [lo, hi] shows through where nothing inside does
+  uint32_t base = RANGE_NONE;
+  for (int l = (int)len - 1; l >= 0; l--) {
+    auto cover = prefixes.find(prefixKey(lo & prefixMask(l), l));
+    if (cover != prefixes.end()) {
+      base = cover->second;
+      break;
+    }
+  }
+  // only the intervals starting inside [lo, hi] change; the segments holding them are laid
+  // out again together with one neighbour on each side, where merges across the edges happen
+  size_t first = std::upper_bound(segment_starts.begin(), segment_starts.end(), lo) -
+                 segment_starts.begin() - 1;
+  size_t last = std::upper_bound(segment_starts.begin(), segment_starts.end(), hi) -
+                segment_starts.begin();
+  first -= first > 0;
+  last += last < segments.size();
+  vector<uint32_t> old_starts, old_owners;
+  for (size_t i = first; i < last; i++) {
+    old_starts.insert(old_starts.end(), segments[i]->starts.begin(), segments[i]->starts.end());
+    old_owners.insert(old_owners.end(), segments[i]->owners.begin(), segments[i]->owners.end());
+  }
+  size_t inside = std::lower_bound(old_starts.begin(), old_starts.end(), lo) - old_starts.begin();
+  size_t above = std::upper_bound(old_starts.begin(), old_starts.end(), hi) - old_starts.begin();
+  uint32_t after = old_owners[above - 1];
+  vector<uint32_t> s(old_starts.begin(), old_starts.begin() + inside);
+  vector<uint32_t> o(old_owners.begin(), old_owners.begin() + inside);
+  flatten(lo, hi, base, s, o);
+  if (hi != 0xffffffffu) {
+    emitInterval(s, o, hi + 1, after);
+    for (size_t i = above; i < old_starts.size(); i++) {
+      emitInterval(s, o, old_starts[i], old_owners[i]);
+    }
+  }
+  spliceSegments(first, last, s, o);
+  publishOrDefer();
+}
+
+void rangeBegin() {
+  range_writer.lock();
+  range_batch = true;
+  range_dirty = false;
+}
+
+void rangeCommit() {
+  if (range_dirty) {
+    publish();
+  }
+  range_batch = false;
+  range_writer.unlock();
+}
+
+void rangeLoad(const FibRoute *routes, size_t count) {
+  std::lock_guard<std::mutex> lock(range_writer);
+  vector<uint64_t> keys(count);
+  vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++) {
+    uint32_t start = ntohl(routes[i].addr) & prefixMask(routes[i].len);
+    keys[i] = prefixKey(start, routes[i].len);
+    order[i] = i;
+  }
+  // in key order the searches stay in cache; stable, so the last duplicate wins
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+  for (size_t i : order) {
+    auto it = prefixes.lower_bound(keys[i]);
+    if (it != prefixes.end() && it->first == keys[i]) {
+      setEntry(it->second, &routes[i].entry);
+    } else {
+      prefixes.emplace_hint(it, keys[i], allocId(&routes[i].entry));
+    }
+  }
+  vector<uint32_t> s, o;
+  flatten(0, 0xffffffffu, RANGE_NONE, s, o);
+  spliceSegments(0, segments.size(), s, o);
+  publish();
+}
+
+bool rangeLookup(uint32_t addr, FibEntry *entry) {
+  uint32_t key = ntohl(addr);
+  uint32_t owner = RANGE_NONE;
+  int slot = fibReadLock();
+  const RangeTable *table = range_table.load();
+  if (table) {
+    const RangeSegment *segment = table->segments[searchIndex(&table->top, key)];
+    owner = searchIndex(&segment->index, key);
+    if (owner != RANGE_NONE) {
+      *entry = table->chunks[owner / RANGE_CHUNK]->entries[owner % RANGE_CHUNK];
+    }
+  }
+  fibReadUnlock(slot);
+  return owner != RANGE_NONE && entry->paths > 0;
+}
+
+uint64_t rangeGeneration() { return range_generation.load(); }
+
+void rangeStats(uint32_t *intervals, size_t *bytes) {
+  int slot = fibReadLock();
+  const RangeTable *table = range_table.load();
+  *intervals = table ? table->intervals : 1;
+  *bytes = 0;
+  if (table) {
+    *bytes = sizeof(RangeTable) + indexBytes(&table->top) +
+             table->chunk_count * (sizeof(RangeChunk *) + sizeof(RangeChunk));
+    for (uint32_t i = 0; i < table->segment_count; i++) {
+      *bytes += sizeof(RangeSegment *) + indexBytes(&table->segments[i]->index);
+    }
+  }
+  fibReadUnlock(slot);
+}
@@ -0,0 +1,66 @@
+#ifndef __RANGE_H__
+#define __RANGE_H__
+
+#include "fib.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  另一种最长前缀匹配的实现：把前缀集合展开成互不重叠、首尾相接的地址区间，
+  每个区间对应覆盖它的最长前缀，相邻区间对应的前缀总是不同。
+  查询就是找最后一个起点不超过目标地址的区间。区间起点按 Eytzinger（BFS）顺序存放，
+  二分查找不需要分支，并且可以提前预取后面几层。
+  区间按地址顺序切成若干段，每段最多 RANGE_SEGMENT 个区间，各自排成一个 Eytzinger 数组，
+  上面再用一个 Eytzinger 数组按段的起点找到段。更新一个前缀时只重新展开它覆盖的地址范围，
+  只重新排列这个范围所在的段和两侧各一段，新表和旧表共用其余的段；
+  读者不加锁，旧表和被替换的段借用 FIB 的 epoch 机制回收。
+*/
+
+/**
+ * @brief 插入、替换或者删除一个前缀
+ * @param addr 前缀地址，大端序
+ * @param len 前缀长度
+ * @param entry 转发信息，为 NULL 表示删除这个前缀
+ */
+void rangeUpdate(uint32_t addr, uint32_t len, const FibEntry *entry);
+
+/**
+ * @brief 开始一批 rangeUpdate() ，它们只修改区间，rangeCommit() 时才排列并发布一次；
+ *        批处理期间其他线程不能写区间表
+ */
+void rangeBegin();
+
+/**
+ * @brief 发布 rangeBegin() 之后的所有修改，没有修改时不发布
+ */
+void rangeCommit();
+
+/**
+ * @brief 批量插入或替换前缀，最后只展开和发布一次
+ * @param routes 前缀数组，addr 为大端序，不要求有序，重复的前缀以最后一个为准
+ * @param count 前缀个数
+ */
+void rangeLoad(const FibRoute *routes, size_t count);
+
+/**
+ * @brief 最长前缀匹配，可以在任意线程中无锁调用
+ * @param addr 目标地址，大端序
+ * @param entry 查到时写入匹配前缀的转发信息
+ * @return 查到则返回 true ，没查到则返回 false
+ */
+bool rangeLookup(uint32_t addr, FibEntry *entry);
+
+/**
+ * @brief 区间表的版本号，每次发布新表后加一
+ * @return 当前版本号
+ */
+uint64_t rangeGeneration();
+
+/**
+ * @brief 当前区间表的大小
+ * @param intervals 区间个数
+ * @param bytes 查询用到的内存字节数
+ */
+void rangeStats(uint32_t *intervals, size_t *bytes);
+
+#endif
@@ -0,0 +1,169 @@
+#include "fib.h"
+#include "ortc.h"
+#include "range.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+using std::vector;
+
+// 比较三种查询结构的内存和查询延迟：每个 RIB 前缀一个表项的前缀树、
+// ORTC 聚合后的前缀树（默认的 FIB），以及 range.h 的 Eytzinger 区间表；
+// 再比较增删前缀的开销，并检查三者在更新前后的查询结果完全一致。
+// 每个规模在单独的子进程中运行。
+
+#define N_NEIGHBOURS 8
+#define N_LOOKUPS 2000000
+#define N_UPDATES 200
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static FibRoute randomRoute(const vector<uint32_t> &block_hop) {
+  uint32_t r = xorshift() % 100;
+  uint32_t len = r < 55 ? 24 : r < 70 ? 22 + r % 2 : r < 88 ? 16 + r % 6 : 8 + r % 8;
+  uint32_t addr = xorshift() & ~(0xffffffffu >> len);
+  uint32_t hop = xorshift() % 100 < 85 ? block_hop[addr >> 20] : xorshift() % N_NEIGHBOURS;
+  FibRoute route = {htonl(addr), len, {htonl(1), 1, {htonl(0x0a000001 + hop)}, {hop % 4}}};
+  return route;
+}
+
+static bool routeLess(const FibRoute &a, const FibRoute &b) {
+  uint32_t x = ntohl(a.addr), y = ntohl(b.addr);
+  return x != y ? x < y : a.len < b.len;
+}
+
+static double lookupNs(bool (*lookup)(uint32_t, FibEntry *), const vector<uint32_t> &addrs,
+                       vector<uint32_t> &result) {
+  FibEntry entry;
+  result.resize(addrs.size());
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < addrs.size(); i++) {
+    result[i] = lookup(addrs[i], &entry) ? entry.nexthop[0] : 0;
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() / addrs.size();
+}
+
+static double sinceMs(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static uint32_t mismatches(const vector<uint32_t> &a, const vector<uint32_t> &b) {
+  uint32_t count = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    count += a[i] != b[i];
+  }
+  return count;
+}
+
+static int evaluate(uint32_t n) {
+  vector<uint32_t> block_hop(1 << 12);
+  for (auto &hop : block_hop) {
+    hop = xorshift() % N_NEIGHBOURS;
+  }
+  vector<FibRoute> routes;
+  for (uint32_t i = 0; i < n; i++) {
+    routes.push_back(randomRoute(block_hop));
+  }
+  // one entry per prefix for the plain trie, the last duplicate wins
+  vector<FibRoute> sorted(routes.rbegin(), routes.rend());
+  std::stable_sort(sorted.begin(), sorted.end(), routeLess);
+  sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                           [](const FibRoute &a, const FibRoute &b) {
+                             return a.addr == b.addr && a.len == b.len;
+                           }),
+               sorted.end());
+  vector<uint32_t> addrs;
+  for (uint32_t i = 0; i < N_LOOKUPS; i++) {
+    const FibRoute &route = routes[xorshift() % routes.size()];
+    addrs.push_back(route.addr | htonl(xorshift() & (0xffffffffu >> route.len)));
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  fibReplace(sorted.data(), sorted.size());
+  double plain_build = sinceMs(begin);
+  size_t plain_bytes = fibMemory();
+  vector<uint32_t> plain, aggregated, ranged;
+  double plain_ns = lookupNs(fibLookup, addrs, plain);
+
+  begin = std::chrono::steady_clock::now();
+  ortcLoad(routes.data(), routes.size());
+  double ortc_build = sinceMs(begin);
+  size_t ortc_bytes = fibMemory();
+  double ortc_ns = lookupNs(fibLookup, addrs, aggregated);
+
+  begin = std::chrono::steady_clock::now();
+  rangeLoad(routes.data(), routes.size());
+  double range_build = sinceMs(begin);
+  uint32_t intervals;
+  size_t range_bytes;
+  rangeStats(&intervals, &range_bytes);
+  double range_ns = lookupNs(rangeLookup, addrs, ranged);
+
+  printf("%8zu prefixes, %8u intervals\n", sorted.size(), intervals);
+  printf("  trie       %7.1f MB  build %7.1f ms  lookup %6.1f ns\n", plain_bytes / 1048576.0,
+         plain_build, plain_ns);
+  printf("  ortc trie  %7.1f MB  build %7.1f ms  lookup %6.1f ns\n", ortc_bytes / 1048576.0,
+         ortc_build, ortc_ns);
+  printf("  range      %7.1f MB  build %7.1f ms  lookup %6.1f ns\n", range_bytes / 1048576.0,
+         range_build, range_ns);
+  uint32_t wrong = mismatches(plain, aggregated) + mismatches(plain, ranged);
+
+  // churn: the same inserts and removals on the ORTC FIB and on the range table
+  vector<FibRoute> churn;
+  vector<bool> remove;
+  for (uint32_t i = 0; i < N_UPDATES; i++) {
+    if (xorshift() & 1) {
+      churn.push_back(routes[xorshift() % routes.size()]);
+      remove.push_back(true);
+    } else {
+      churn.push_back(randomRoute(block_hop));
+      remove.push_back(false);
+    }
+  }
+  begin = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < N_UPDATES; i++) {
+    ortcUpdate(churn[i].addr, churn[i].len, remove[i] ? NULL : &churn[i].entry);
+  }
+  double ortc_update = sinceMs(begin) * 1000 / N_UPDATES;
+  begin = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < N_UPDATES; i++) {
+    rangeUpdate(churn[i].addr, churn[i].len, remove[i] ? NULL : &churn[i].entry);
+  }
+  double range_update = sinceMs(begin) * 1000 / N_UPDATES;
+  lookupNs(fibLookup, addrs, aggregated);
+  lookupNs(rangeLookup, addrs, ranged);
+  wrong += mismatches(aggregated, ranged);
+  printf("  update: ortc trie %8.1f us, range %8.1f us;  %u mismatches\n", ortc_update,
+         range_update, wrong);
+  return wrong == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  const uint32_t sizes[] = {10000, 100000, 500000, 1000000};
+  int failed = 0;
+  for (uint32_t n : sizes) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      int result = evaluate(n);
+      fflush(stdout);
+      _exit(result);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  printf(failed ? "FAILED\n" : "OK\n");
+  return failed;
+}
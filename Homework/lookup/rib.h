@@ -0,0 +1,52 @@
+#ifndef __RIB_H__
+#define __RIB_H__
+
+#include "rip.h"
+#include <stdint.h>
+
+/*
+  RibTransaction 把一个 RIP Response 中的所有表项作为一次事务应用到 RIB（lookup.cpp 中的 RouteTable）。
+  每个表项按 (addr, len) 精确查找，O(1) 地完成距离向量的比较和修改；
+  期间 RIB 的修改立即可见，但查询结构（FIB 或区间表）不变，
+  commit() 时每个变化的前缀只同步一次，再整体发布一次，查询缓存也只失效一次。
+  同一时刻只能有一个事务，只在主线程中使用。
+*/
+class RibTransaction {
+public:
+  RibTransaction();
+  // 没有提交的事务在析构时提交
+  ~RibTransaction();
+
+  /**
+   * @brief 应用邻居通告的一条路由，ref. RFC2453 3.9.2
+   * @param addr 前缀地址，大端序
+   * @param len 前缀长度
+   * @param if_index 收到通告的端口
+   * @param nexthop 邻居的地址，大端序
+   * @param metric 通告的 metric ，大端序，16 表示不可达
+   *
+   * 每个邻居通告的每个前缀都记下来，替换这个邻居之前的通告并重新计时；
+   * metric 最小的路径被选中（等价的最多 FIB_MAX_PATHS 条），其余的作为备份。
+   * 不可达时删除经过这个邻居的路径，选中的路径删完时最好的备份路径立即接替。
+   */
+  void apply(uint32_t addr, uint32_t len, uint32_t if_index, uint32_t nexthop, uint32_t metric);
+
+  /**
+   * @brief 应用一个 RIP Response 中的所有表项
+   * @param rip 已经检查过的 RIP 包
+   * @param if_index 收到 RIP 包的端口
+   * @param src_addr RIP 包的源地址，即邻居的地址，大端序
+   */
+  void applyResponse(const RipPacketView &rip, uint32_t if_index, uint32_t src_addr);
+
+  /**
+   * @brief 把事务中的修改同步到查询结构并发布
+   * @return 转发信息有变化的前缀个数
+   */
+  uint32_t commit();
+
+private:
+  bool open;
+};
+
+#endif
@@ -0,0 +1 @@
+../protocol/rip.h
\ No newline at end of file
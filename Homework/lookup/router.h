@@ -1,5 +1,10 @@
 #include <stdint.h>
 
+struct RouteTimer;
+
+// update(false, entry, ROUTE_ANY_INTERFACE) 按 addr 和 len 删除整个前缀，不区分出端口和下一跳
+#define ROUTE_ANY_INTERFACE 0xffffffffu
+
 // 路由表的一项
 typedef struct {
     uint32_t addr; // 地址
@@ -8,4 +13,6 @@ typedef struct {
     uint32_t nexthop; // 下一条的地址，0 表示直连
     uint32_t metric;
     // 为了实现 RIP 协议，需要在这里添加额外的字段
+    bool changed; // 变化之后还没有在触发更新中发送过，见 lookup.cpp 中的 writeRipEntries()
+    struct RouteTimer *timeout; // 学到的路由的超时定时器，由 lookup.cpp 管理，直连和导入的路由为 NULL
 } RoutingTableEntry;
\ No newline at end of file
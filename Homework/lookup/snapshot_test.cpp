@@ -0,0 +1,164 @@
+#include "fib.h"
+#include "ortc.h"
+#include "router_hal.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+using std::vector;
+
+// 热重启快照与当前 FIB 合并查询的测试：两边都用 ortcLoad() 聚合，
+// 聚合留下的“无路由”表项（paths 为 0）只在自己那一层生效，不能遮住另一层更短的路由；
+// 另外改坏快照里的表项再补上校验和，确认 fibLoadSnapshot() 拒绝加载
+
+#define SNAPSHOT_FILE "snapshot_test.snapshot"
+#define TAMPERED_FILE "snapshot_test.tampered"
+
+// mirrors the file layout in fib.cpp
+struct SnapshotNode {
+  uint32_t child[2];
+  FibEntry entry;
+  uint32_t valid;
+};
+
+static FibRoute route(uint32_t addr, uint32_t len, uint32_t hop) {
+  FibRoute r = {htonl(addr), len, {htonl(1), 1, {htonl(0x0a000001 + hop)}, {hop % 4}}};
+  return r;
+}
+
+// three quarters of a /8 through one hop, ORTC announces the /8 and a null for the last quarter
+static void addThreeQuarters(vector<FibRoute> &routes, uint32_t addr, uint32_t hop) {
+  routes.push_back(route(addr, 9, hop));
+  routes.push_back(route(addr | 0x00800000, 10, hop));
+  routes.push_back(route(addr | 0x00c00000, 11, hop));
+}
+
+static void clear(const vector<FibRoute> &routes) {
+  for (const FibRoute &r : routes) {
+    ortcUpdate(r.addr, r.len, NULL);
+  }
+}
+
+#define NO_ROUTE -1
+
+// the hop of the route to addr, NO_ROUTE when there is none
+static int lookupHop(uint32_t addr) {
+  FibEntry entry;
+  if (!fibLookup(htonl(addr), &entry)) {
+    return NO_ROUTE;
+  }
+  return ntohl(entry.nexthop[0]) - 0x0a000001;
+}
+
+static bool expect(const char *what, uint32_t addr, int hop) {
+  int got = lookupHop(addr);
+  bool ok = got == hop;
+  printf("%-48s %u.%u.%u.%u: ", what, addr >> 24, addr >> 16 & 0xff, addr >> 8 & 0xff, addr & 0xff);
+  if (got == NO_ROUTE) {
+    printf("no route");
+  } else {
+    printf("hop %d", got);
+  }
+  printf(ok ? "\n" : " FAILED\n");
+  return ok;
+}
+
+// rewrites SNAPSHOT_FILE into TAMPERED_FILE with edit applied to the first route, the
+// checksum recomputed; returns whether fibLoadSnapshot() accepts the result
+static bool loadTampered(void (*edit)(FibEntry *entry)) {
+  FILE *fp = fopen(SNAPSHOT_FILE, "rb");
+  if (!fp) {
+    return false;
+  }
+  uint32_t header[4]; // magic, version, node_count, checksum
+  vector<SnapshotNode> nodes;
+  if (fread(header, sizeof(header), 1, fp) == 1) {
+    nodes.resize(header[2]);
+    nodes.resize(fread(nodes.data(), sizeof(SnapshotNode), nodes.size(), fp));
+  }
+  fclose(fp);
+  for (SnapshotNode &node : nodes) {
+    if (node.valid && node.entry.paths > 0) {
+      edit(&node.entry);
+      break;
+    }
+  }
+  const uint32_t *words = (const uint32_t *)nodes.data();
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < nodes.size() * sizeof(SnapshotNode) / sizeof(uint32_t); i++) {
+    hash = (hash ^ words[i]) * 16777619u;
+  }
+  header[3] = hash;
+  fp = fopen(TAMPERED_FILE, "wb");
+  if (!fp) {
+    return false;
+  }
+  fwrite(header, sizeof(header), 1, fp);
+  fwrite(nodes.data(), sizeof(SnapshotNode), nodes.size(), fp);
+  fclose(fp);
+  bool loaded = fibLoadSnapshot(TAMPERED_FILE);
+  unlink(TAMPERED_FILE);
+  return loaded;
+}
+
+static void keepEntry(FibEntry *) {}
+
+static void tooManyPaths(FibEntry *entry) { entry->paths = FIB_MAX_PATHS + 1; }
+
+static void badInterface(FibEntry *entry) { entry->if_index[0] = N_IFACE_ON_BOARD; }
+
+static bool expectLoad(const char *what, void (*edit)(FibEntry *entry), bool accepted) {
+  bool loaded = loadTampered(edit);
+  printf("%-48s %s%s\n", what, loaded ? "loaded" : "rejected", loaded == accepted ? "" : " FAILED");
+  return loaded == accepted;
+}
+
+int main(int argc, char *argv[]) {
+  bool ok = true;
+
+  // the table before the restart, saved as the snapshot
+  vector<FibRoute> before;
+  before.push_back(route(0x0a000000, 8, 2));       // 10/8 via 2
+  addThreeQuarters(before, 0x14000000, 2);         // 20/8 via 2 but 20.224/11
+  before.push_back(route(0x1e000000, 8, 2));       // 30/8 via 2
+  ortcLoad(before.data(), before.size());
+  if (!fibSaveSnapshot(SNAPSHOT_FILE)) {
+    printf("cannot write %s\n", SNAPSHOT_FILE);
+    return 1;
+  }
+  clear(before);
+
+  // what RIP has relearned so far
+  vector<FibRoute> after;
+  addThreeQuarters(after, 0x0a000000, 1);          // 10/8 via 1 but 10.224/11
+  after.push_back(route(0x14000000, 8, 1));        // 20/8 via 1
+  ortcLoad(after.data(), after.size());
+  uint32_t rib_prefixes, fib_prefixes;
+  ortcStats(&rib_prefixes, &fib_prefixes);
+  printf("live FIB: %u prefixes aggregated from %u routes\n", fib_prefixes, rib_prefixes);
+  ok &= expect("live null, nothing below it", 0x0ae00001, NO_ROUTE);
+
+  if (!fibLoadSnapshot(SNAPSHOT_FILE)) {
+    printf("cannot load %s\n", SNAPSHOT_FILE);
+    return 1;
+  }
+  ok &= expect("live route", 0x0a000001, 1);
+  ok &= expect("live null over a shorter snapshot route", 0x0ae00001, 2);
+  ok &= expect("snapshot null over a shorter live route", 0x14e00001, 1);
+  ok &= expect("live route over a snapshot route", 0x14000001, 1);
+  ok &= expect("snapshot route only", 0x1e000001, 2);
+  ok &= expect("neither", 0x28000001, NO_ROUTE);
+
+  ok &= expectLoad("snapshot rewritten as is", keepEntry, true);
+  ok &= expectLoad("snapshot with too many paths", tooManyPaths, false);
+  ok &= expectLoad("snapshot with an interface out of range", badInterface, false);
+  ok &= expect("snapshot route after the rejected loads", 0x1e000001, 2);
+
+  fibDropSnapshot();
+  ok &= expect("live null after the snapshot is dropped", 0x0ae00001, NO_ROUTE);
+  clear(after);
+  unlink(SNAPSHOT_FILE);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
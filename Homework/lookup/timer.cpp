@@ -0,0 +1,199 @@
+#include "timer.h"
+#include <stddef.h>
+
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+// the timer is on the list of a slot being run
+#define TIMER_RUNNING (-2)
+
+// list heads, slot s of level l is heads[l * TIMER_SLOTS + s]
+static Timer heads[TIMER_LEVELS * TIMER_SLOTS];
+// bit s of occupied[l] is set when that slot is not empty
+static uint64_t occupied[TIMER_LEVELS];
+static uint64_t wheel_now = 0;
+static bool started = false;
+
+static void listInit(Timer *head)
+{
+  head->prev = head;
+  head->next = head;
+}
+
+static void listAppend(Timer *head, Timer *timer)
+{
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+static void unlink(Timer *timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  if (timer->slot >= 0) {
+    Timer *head = &heads[timer->slot];
+    if (head->next == head) {
+      occupied[timer->slot / TIMER_SLOTS] &= ~(1ull << (timer->slot % TIMER_SLOTS));
+    }
+  }
+  timer->slot = -1;
+}
+
+// earliest is the first tick whose level 0 slot is still going to be run
+static void place(Timer *timer, uint64_t earliest)
+{
+  uint64_t expire = timer->expire > earliest ? timer->expire : earliest;
+  uint64_t delta = expire - wheel_now;
+  uint32_t level = 0;
+  while (level + 1 < TIMER_LEVELS && delta >= (1ull << ((level + 1) * TIMER_SLOT_BITS))) {
+    level++;
+  }
+  if (delta >= (1ull << (TIMER_LEVELS * TIMER_SLOT_BITS))) {
+    // further than the wheel reaches, it is placed again when the top slot comes round
+    expire = wheel_now + (1ull << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1;
+  }
+  uint32_t slot = (expire >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+  timer->slot = level * TIMER_SLOTS + slot;
+  listAppend(&heads[timer->slot], timer);
+  occupied[level] |= 1ull << slot;
+}
+
+// spreads the current slot of a level over the levels below
+static void cascade(uint32_t level)
+{
+  uint32_t slot = (wheel_now >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+  if (slot == 0 && level + 1 < TIMER_LEVELS) {
+    cascade(level + 1);
+  }
+  Timer *head = &heads[level * TIMER_SLOTS + slot];
+  while (head->next != head) {
+    Timer *timer = head->next;
+    unlink(timer);
+    // the current level 0 slot is run right after cascading
+    place(timer, wheel_now);
+  }
+}
+
+static void runSlot(uint32_t slot)
+{
+  Timer *head = &heads[slot];
+  if (head->next == head) {
+    return;
+  }
+  // move the slot to a local list first, callbacks may arm timers into this slot again
+  Timer due;
+  listInit(&due);
+  due.next = head->next;
+  due.prev = head->prev;
+  due.next->prev = &due;
+  due.prev->next = &due;
+  listInit(head);
+  occupied[0] &= ~(1ull << slot);
+  for (Timer *timer = due.next; timer != &due; timer = timer->next) {
+    timer->slot = TIMER_RUNNING;
+  }
+  while (due.next != &due) {
+    Timer *timer = due.next;
+    unlink(timer);
+    if (timer->callback) {
+      timer->callback(timer->arg);
+    }
+  }
+}
+
+void timerStart(uint64_t now)
+{
+  for (uint32_t i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++) {
+    listInit(&heads[i]);
+  }
+  for (uint32_t i = 0; i < TIMER_LEVELS; i++) {
+    occupied[i] = 0;
+  }
+  wheel_now = now;
+  started = true;
+}
+
+void timerInit(Timer *timer, TimerCallback callback, void *arg)
+{
+  timer->prev = timer;
+  timer->next = timer;
+  timer->expire = 0;
+  timer->slot = -1;
+  timer->callback = callback;
+  timer->arg = arg;
+}
+
+void timerArm(Timer *timer, uint64_t delay)
+{
+  if (!started) {
+    timerStart(0);
+  }
+  if (timer->slot != -1) {
+    unlink(timer);
+  }
+  timer->expire = wheel_now + delay;
+  place(timer, wheel_now + 1);
+}
+
+void timerCancel(Timer *timer)
+{
+  if (timer->slot != -1) {
+    unlink(timer);
+  }
+}
+
+bool timerPending(const Timer *timer)
+{
+  return timer->slot != -1;
+}
+
+void timerRun(uint64_t now)
+{
+  if (!started) {
+    timerStart(now);
+    return;
+  }
+  while (wheel_now < now) {
+    if (occupied[0] == 0) {
+      // nothing is due before level 0 comes round, skip to there
+      uint64_t skip = wheel_now | TIMER_SLOT_MASK;
+      if (skip >= now) {
+        wheel_now = now;
+        break;
+      }
+      wheel_now = skip;
+    }
+    wheel_now++;
+    uint32_t slot = wheel_now & TIMER_SLOT_MASK;
+    if (slot == 0) {
+      cascade(1);
+    }
+    runSlot(slot);
+  }
+}
+
+static inline uint64_t rotateRight(uint64_t bits, uint32_t shift)
+{
+  shift &= 63;
+  return shift ? (bits >> shift) | (bits << (64 - shift)) : bits;
+}
+
+int64_t timerNextTimeout(int64_t max)
+{
+  uint64_t best = max;
+  for (uint32_t level = 0; level < TIMER_LEVELS; level++) {
+    if (occupied[level] == 0) {
+      continue;
+    }
+    // the first occupied slot after the current one, its timers are due (level 0)
+    // or cascaded (above) when the wheel reaches its start
+    uint32_t shift = level * TIMER_SLOT_BITS;
+    uint64_t current = wheel_now >> shift;
+    uint64_t next = current + 1 + __builtin_ctzll(rotateRight(occupied[level], (current + 1) & TIMER_SLOT_MASK));
+    uint64_t wait = (next << shift) - wheel_now;
+    if (wait < best) {
+      best = wait;
+    }
+  }
+  return best;
+}
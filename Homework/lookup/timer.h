@@ -0,0 +1,78 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stdint.h>
+
+/*
+  分层时间轮，时间单位为毫秒，与 HAL_GetTicks() 相同。
+  共 TIMER_LEVELS 层，每层 TIMER_SLOTS 个槽，第 i 层一个槽跨越 TIMER_SLOTS^i 毫秒；
+  定时器按到期时间与当前时间的差放进对应的层，时间走到上一层的槽时再把其中的定时器
+  分散到下面的层。启动、重新启动（刷新）和取消都是 O(1) 的链表操作，
+  每个定时器在到期之前最多被移动 TIMER_LEVELS - 1 次。
+  Timer 由使用者分配，在链表上时不能移动或释放；不是线程安全的，只在主循环中使用。
+*/
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
+typedef void (*TimerCallback)(void *arg);
+
+typedef struct Timer {
+  struct Timer *prev;
+  struct Timer *next;
+  uint64_t expire;        // 到期时间，毫秒
+  int32_t slot;           // 所在的槽，-1 表示没有启动
+  TimerCallback callback; // 到期时在 timerRun() 中调用，可以为 NULL
+  void *arg;
+} Timer;
+
+/**
+ * @brief 设置时间轮的当前时间，启动任何定时器之前调用一次
+ * @param now 当前时间，毫秒
+ */
+void timerStart(uint64_t now);
+
+/**
+ * @brief 初始化一个定时器，初始状态为没有启动
+ * @param timer 定时器
+ * @param callback 到期时调用的函数
+ * @param arg 传给 callback 的参数
+ */
+void timerInit(Timer *timer, TimerCallback callback, void *arg);
+
+/**
+ * @brief 启动定时器，已经启动的定时器重新计时
+ * @param timer 定时器
+ * @param delay 从时间轮的当前时间起多少毫秒后到期
+ */
+void timerArm(Timer *timer, uint64_t delay);
+
+/**
+ * @brief 取消定时器，没有启动时什么也不做
+ * @param timer 定时器
+ */
+void timerCancel(Timer *timer);
+
+/**
+ * @brief 定时器是否已经启动且还没有到期
+ * @param timer 定时器
+ * @return 是则返回 true
+ */
+bool timerPending(const Timer *timer);
+
+/**
+ * @brief 把时间轮推进到 now ，按到期时间的顺序调用所有到期的定时器
+ * @param now 当前时间，毫秒
+ *
+ * 回调中可以启动或取消任何定时器，包括它自己。
+ */
+void timerRun(uint64_t now);
+
+/**
+ * @brief 计算主循环最多可以等待多久
+ * @param max 等待时间的上限，毫秒
+ * @return 到下一个定时器到期（或者需要整理上层的槽）的毫秒数，不超过 max
+ */
+int64_t timerNextTimeout(int64_t max);
+
+#endif
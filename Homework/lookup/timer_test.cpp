@@ -0,0 +1,156 @@
+#include "timer.h"
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+using std::vector;
+
+// timer.h 的测试：随机地启动、刷新和取消定时器，时间随机地向前推进，
+// 检查每个定时器恰好在到期时间所在的那一次 timerRun() 中被调用，同一次中按到期时间的顺序；
+// 再测量 50 万个定时器（相当于 50 万条学到的路由）上启动、刷新和取消的开销。
+
+#define N_TIMERS 4096
+#define N_STEPS 200000
+#define N_BENCH 500000
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+typedef struct {
+  Timer timer;
+  uint64_t expire; // 0 when not armed
+} TestTimer;
+
+static vector<TestTimer> timers(N_TIMERS);
+static uint64_t run_begin, run_end, last_fired;
+static uint32_t errors = 0, fired = 0;
+
+static void arm(TestTimer *t, uint64_t now, uint64_t delay) {
+  timerArm(&t->timer, delay);
+  // due at the first run after now when the delay is 0
+  t->expire = now + (delay ? delay : 1);
+}
+
+static void expired(void *arg) {
+  TestTimer *t = (TestTimer *)arg;
+  fired++;
+  if (t->expire == 0 || t->expire <= run_begin || t->expire > run_end || t->expire < last_fired) {
+    if (errors++ < 10) {
+      printf("timer %zu due at %llu fired in (%llu, %llu]\n", t - timers.data(),
+             (unsigned long long)t->expire, (unsigned long long)run_begin, (unsigned long long)run_end);
+    }
+  }
+  last_fired = t->expire;
+  t->expire = 0;
+  // callbacks may arm timers again, some of them due in this run, the wheel is at last_fired
+  if (xorshift() % 4 == 0) {
+    arm(t, last_fired, xorshift() % 8 == 0 ? 0 : xorshift() % 200000);
+  }
+}
+
+static uint64_t randomDelay() {
+  switch (xorshift() % 4) {
+  case 0:
+    return xorshift() % 64;
+  case 1:
+    return xorshift() % 5000;
+  case 2:
+    return 180000 - xorshift() % 1000;
+  default:
+    // beyond the reach of the top level
+    return xorshift() % (1ull << 26);
+  }
+}
+
+static bool randomized() {
+  uint64_t now = 1000000;
+  timerStart(now);
+  for (size_t i = 0; i < timers.size(); i++) {
+    timerInit(&timers[i].timer, expired, &timers[i]);
+    timers[i].expire = 0;
+  }
+  for (uint32_t step = 0; step < N_STEPS; step++) {
+    for (uint32_t k = 0; k < 8; k++) {
+      TestTimer *t = &timers[xorshift() % N_TIMERS];
+      if (xorshift() % 4 == 0) {
+        timerCancel(&t->timer);
+        t->expire = 0;
+      } else {
+        arm(t, now, randomDelay());
+      }
+      if (timerPending(&t->timer) != (t->expire != 0)) {
+        errors++;
+      }
+    }
+    uint64_t advance = xorshift() % 8 == 0 ? xorshift() % 100000 : xorshift() % 100;
+    // the main loop must not sleep past a due timer
+    uint64_t wait = timerNextTimeout(INT64_MAX);
+    uint64_t due = UINT64_MAX;
+    for (size_t i = 0; step % 8 == 0 && i < timers.size(); i++) {
+      if (timers[i].expire && timers[i].expire < due) {
+        due = timers[i].expire;
+      }
+    }
+    if (due != UINT64_MAX && now + wait > due) {
+      if (errors++ < 10) {
+        printf("next timeout %llu after %llu, but a timer is due at %llu\n", (unsigned long long)wait,
+               (unsigned long long)now, (unsigned long long)due);
+      }
+    }
+    run_begin = now;
+    run_end = now + advance;
+    last_fired = 0;
+    timerRun(run_end);
+    now = run_end;
+  }
+  for (size_t i = 0; i < timers.size(); i++) {
+    if (timers[i].expire && timers[i].expire <= now) {
+      errors++;
+    }
+  }
+  printf("randomized: %u steps, %u fired, %u errors\n", N_STEPS, fired, errors);
+  return errors == 0;
+}
+
+static void benchmark() {
+  vector<Timer> routes(N_BENCH);
+  uint64_t now = 0;
+  timerStart(now);
+  for (size_t i = 0; i < routes.size(); i++) {
+    timerInit(&routes[i], NULL, NULL);
+  }
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < routes.size(); i++) {
+    timerArm(&routes[i], 180000 + xorshift() % 5000);
+  }
+  auto armed = std::chrono::steady_clock::now();
+  // refreshed by periodic updates, a few milliseconds apart
+  for (uint32_t round = 0; round < 4; round++) {
+    now += 5000;
+    timerRun(now);
+    for (size_t i = 0; i < routes.size(); i++) {
+      timerArm(&routes[i], 180000);
+    }
+  }
+  auto refreshed = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < routes.size(); i++) {
+    timerCancel(&routes[i]);
+  }
+  auto cancelled = std::chrono::steady_clock::now();
+  printf("%u timers: arm %.1f ns, refresh %.1f ns, cancel %.1f ns\n", N_BENCH,
+         std::chrono::duration<double, std::nano>(armed - begin).count() / N_BENCH,
+         std::chrono::duration<double, std::nano>(refreshed - armed).count() / (4.0 * N_BENCH),
+         std::chrono::duration<double, std::nano>(cancelled - refreshed).count() / N_BENCH);
+}
+
+int main(int argc, char *argv[]) {
+  bool ok = randomized();
+  benchmark();
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1 @@
+../protocol/wire.h
\ No newline at end of file
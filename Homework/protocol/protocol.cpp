@@ -45,48 +45,43 @@
  * Mask 的二进制是不是连续的 1 与连续的 0 组成等等。
  */
 bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output) {
-  uint32_t headlength = 4 * (packet[0] & 0xf) + 8;
-  uint8_t command = packet[headlength];
-  uint8_t version = packet[headlength+1];
-  uint32_t TotalLength = ((uint32_t)packet[2] << 8) + packet[3];
-  if(TotalLength > len) {
+  RipPacketView view;
+  if (!view.parse(packet, len) || view.numEntries() > RIP_MAX_ENTRY) {
     return false;
   }
-  if((command != 0x1 && command != 0x2) || version != 0x2 || packet[headlength+2] != 0x0 || packet[headlength+3] != 0x0) {
+  uint32_t i = 0;
+  for (RipEntryView entry : view) {
+    output->entries[i++] = entry.route();
+  }
+  output->numEntries = view.numEntries();
+  output->command = view.command();
+  return true;
+}
+
+bool RipPacketView::parse(const uint8_t *packet, uint32_t len) {
+  entries = NULL;
+  count = 0;
+  cmd = 0;
+  if (len < 20) {
     return false;
   }
-  uint32_t count = (len - headlength - 4) / 20;
-  for(uint32_t i = 0; i < count; i++) {
-    if((command == 0x2 && packet[headlength + 4 + i*20 + 1] != 0x2) || (command == 0x1 && packet[headlength + 4 + i*20 + 1] != 0x0)) {
-      return false;
-    }
-    if(packet[headlength + 4 + i*20 + 2] != 0x0 || packet[headlength + 4 + i*20 + 3] != 0x0) {
-      return false;
-    }
-    uint32_t addr = packet[headlength + 4 + i*20 + 4] + ((uint32_t)packet[headlength + 4 + i*20 + 5] << 8) + ((uint32_t)packet[headlength + 4 + i*20 + 6] << 16) + ((uint32_t)packet[headlength + 4 + i*20 + 7] << 24);
-    uint32_t mask = packet[headlength + 4 + i*20 + 8] + ((uint32_t)packet[headlength + 4 + i*20 + 9] << 8) + ((uint32_t)packet[headlength + 4 + i*20 + 10] << 16) + ((uint32_t)packet[headlength + 4 + i*20 + 11] << 24);
-    uint32_t nexthop = packet[headlength + 4 + i*20 + 12] + ((uint32_t)packet[headlength + 4 + i*20 + 13] << 8) + ((uint32_t)packet[headlength + 4 + i*20 + 14] << 16) + ((uint32_t)packet[headlength + 4 + i*20 + 15] << 24);
-    uint32_t metric = packet[headlength + 4 + i*20 + 16] + ((uint32_t)packet[headlength + 4 + i*20 + 17] << 8) + ((uint32_t)packet[headlength + 4 + i*20 + 18] << 16) + ((uint32_t)packet[headlength + 4 + i*20 + 19] << 24);
-    uint32_t flag = mask % 2;
-    for(int j = 1; j < 32; j++) {
-      if (((mask >> j) % 2) != flag) {
-        if(flag == 0) {
-          return false;
-        } else {
-          flag = 0;
-        }
-      }
-    }
-    if(ntohl(metric) < 1 || ntohl(metric) > 16) {
-      return false;
-    }
-    output->entries[i].addr = addr;
-    output->entries[i].mask = mask;
-    output->entries[i].nexthop = nexthop;
-    output->entries[i].metric = metric;
+  uint32_t headlength = 4 * (IPv4Wire::VersionIhl::load(packet) & 0xf) + UdpWire::size;
+  uint32_t TotalLength = IPv4Wire::TotalLength::load(packet);
+  if(TotalLength > len || len < headlength + RIP_HEADER_SIZE) {
+    return false;
+  }
+  const uint8_t *rip = packet + headlength;
+  uint8_t command = RipWire::Command::load(rip);
+  if((command != 0x1 && command != 0x2) || RipWire::Version::load(rip) != 0x2 || RipWire::Zero::load(rip) != 0x0) {
+    return false;
+  }
+  uint32_t n = (len - headlength - RIP_HEADER_SIZE) / RIP_ENTRY_SIZE;
+  if(!ripValidateEntries(rip + RIP_HEADER_SIZE, n, command)) {
+    return false;
   }
-  output->numEntries = count;
-  output->command = command;
+  entries = rip + RIP_HEADER_SIZE;
+  count = n;
+  cmd = command;
   return true;
 }
 
@@ -102,31 +97,10 @@ bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output) {
  */
 uint32_t assemble(const RipPacket *rip, uint8_t *buffer) {
   uint32_t count = rip->numEntries;
-  buffer[0] = rip->command;
-  buffer[1] = 0x2;
-  buffer[2] = 0x0;
-  buffer[3] = 0x0;
+  uint16_t family = (rip->command == 0x2) ? 0x2 : 0x0;
+  ripWriteHeader(buffer, rip->command);
   for(uint32_t i = 0; i < count; i++) {
-    buffer[4 + i*20] = 0x0;
-    buffer[4 + i*20 + 1] = (rip->command == 0x2) ? 0x2 : 0x0;
-    buffer[4 + i*20 + 2] = 0x0;
-    buffer[4 + i*20 + 3] = 0x0;
-    buffer[4 + i*20 + 4] = (uint8_t)(rip->entries[i].addr & 0xff);
-    buffer[4 + i*20 + 5] = (uint8_t)((rip->entries[i].addr >> 8) & 0xff);
-    buffer[4 + i*20 + 6] = (uint8_t)((rip->entries[i].addr >> 16) & 0xff);
-    buffer[4 + i*20 + 7] = (uint8_t)((rip->entries[i].addr >> 24) & 0xff);
-    buffer[4 + i*20 + 8] = (uint8_t)(rip->entries[i].mask & 0xff);
-    buffer[4 + i*20 + 9] = (uint8_t)((rip->entries[i].mask >> 8) & 0xff);
-    buffer[4 + i*20 + 10] = (uint8_t)((rip->entries[i].mask >> 16) & 0xff);
-    buffer[4 + i*20 + 11] = (uint8_t)((rip->entries[i].mask >> 24) & 0xff);
-    buffer[4 + i*20 + 12] = (uint8_t)(rip->entries[i].nexthop & 0xff);
-    buffer[4 + i*20 + 13] = (uint8_t)((rip->entries[i].nexthop >> 8) & 0xff);
-    buffer[4 + i*20 + 14] = (uint8_t)((rip->entries[i].nexthop >> 16) & 0xff);
-    buffer[4 + i*20 + 15] = (uint8_t)((rip->entries[i].nexthop >> 24) & 0xff);
-    buffer[4 + i*20 + 16] = (uint8_t)(rip->entries[i].metric & 0xff);
-    buffer[4 + i*20 + 17] = (uint8_t)((rip->entries[i].metric >> 8) & 0xff);
-    buffer[4 + i*20 + 18] = (uint8_t)((rip->entries[i].metric >> 16) & 0xff);
-    buffer[4 + i*20 + 19] = (uint8_t)((rip->entries[i].metric >> 24) & 0xff);
+    ripWriteEntry(buffer + RIP_HEADER_SIZE + i * RIP_ENTRY_SIZE, family, rip->entries[i]);
   }
   return 4 + 20*count;
 }
@@ -1,5 +1,13 @@
+#ifndef __RIP_H__
+#define __RIP_H__
+
+#include "wire.h"
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #define RIP_MAX_ENTRY 25
+#define RIP_HEADER_SIZE 4
+#define RIP_ENTRY_SIZE 20
 typedef struct {
   // all fields are big endian
   // we don't store 'family', as it is always 2(response) and 0(request)
@@ -10,6 +18,12 @@ typedef struct {
   uint32_t metric;
 } RipEntry;
 
+static_assert(RIP_HEADER_SIZE == RipWire::size && RIP_ENTRY_SIZE == RipEntryWire::size, "RIP sizes");
+// RipEntry 与表项中 Address 到 Metric 的部分逐字节相同，整段复制即可
+static_assert(sizeof(RipEntry) == RipEntryWire::Route::size, "RipEntry does not match the wire format");
+static_assert(offsetof(RipEntry, metric) == RipEntryWire::Metric::offset - RipEntryWire::Route::offset,
+              "RipEntry does not match the wire format");
+
 typedef struct {
   uint32_t numEntries;
   // all fields below are big endian
@@ -17,4 +31,104 @@ typedef struct {
   // we don't store 'version', as it is always 2
   // we don't store 'zero', as it is always 0
   RipEntry entries[RIP_MAX_ENTRY];
-} RipPacket;
\ No newline at end of file
+} RipPacket;
+
+/*
+  RipPacketView 是接收到的 IP 包中 RIP 部分的只读视图，检查合法性的规则与 disassemble() 相同，
+  但不复制任何数据，也不受 RIP_MAX_ENTRY 的限制：遍历表项时直接从原来的缓冲区中读出各个字段，
+  字段与 RipEntry 一样是大端序。视图不拥有缓冲区，使用期间缓冲区不能被覆盖。
+*/
+class RipEntryView {
+public:
+  explicit RipEntryView(const uint8_t *entry) : entry(entry) {}
+  uint32_t addr() const { return RipEntryWire::Addr::load(entry); }
+  uint32_t mask() const { return RipEntryWire::Mask::load(entry); }
+  uint32_t nexthop() const { return RipEntryWire::Nexthop::load(entry); }
+  uint32_t metric() const { return RipEntryWire::Metric::load(entry); }
+  // 四个字段一起读出
+  RipEntry route() const {
+    RipEntry route;
+    RipEntryWire::Route::load(entry, &route);
+    return route;
+  }
+
+private:
+  const uint8_t *entry;
+};
+
+/**
+ * @brief 按 RIP 的格式写一个表项
+ * @param entry 表项的起始地址，RIP_ENTRY_SIZE 字节，不要求对齐
+ * @param family Address Family ，Response 中为 2 ，Request 中为 0
+ * @param route 表项的内容，字段都是大端序
+ */
+static inline void ripWriteEntry(uint8_t *entry, uint16_t family, const RipEntry &route) {
+  RipEntryWire::Family::store(entry, family);
+  RipEntryWire::Tag::store(entry, 0);
+  RipEntryWire::Route::store(entry, &route);
+}
+
+/**
+ * @brief 写 RIP 头，Version 为 2
+ * @param rip RIP 头的起始地址
+ * @param command RIP 的 Command
+ */
+static inline void ripWriteHeader(uint8_t *rip, uint8_t command) {
+  RipWire::Command::store(rip, command);
+  RipWire::Version::store(rip, 2);
+  RipWire::Zero::store(rip, 0);
+}
+
+class RipPacketView {
+public:
+  class Iterator {
+  public:
+    explicit Iterator(const uint8_t *entry) : entry(entry) {}
+    RipEntryView operator*() const { return RipEntryView(entry); }
+    Iterator &operator++() {
+      entry += RIP_ENTRY_SIZE;
+      return *this;
+    }
+    bool operator!=(const Iterator &other) const { return entry != other.entry; }
+
+  private:
+    const uint8_t *entry;
+  };
+
+  RipPacketView() : entries(NULL), count(0), cmd(0) {}
+
+  /**
+   * @brief 检查接收到的 IP 包是否是合法的 RIP 包，合法时让视图指向它的表项
+   * @param packet 接受到的 IP 包
+   * @param len 即 packet 的长度
+   * @return 合法则返回 true ；否则返回 false ，视图变为空
+   */
+  bool parse(const uint8_t *packet, uint32_t len);
+
+  uint8_t command() const { return cmd; }
+  uint32_t numEntries() const { return count; }
+  RipEntryView entry(uint32_t i) const { return RipEntryView(entries + i * RIP_ENTRY_SIZE); }
+  Iterator begin() const { return Iterator(entries); }
+  Iterator end() const { return Iterator(entries + count * RIP_ENTRY_SIZE); }
+
+private:
+  const uint8_t *entries;
+  uint32_t count;
+  uint8_t cmd;
+};
+
+/**
+ * @brief 检查连续的 count 个 RIP 表项：Address Family 与 command 对应，Route Tag 为 0，
+ *        Mask 由连续的 1 和连续的 0 组成，Metric 在 [1,16] 的区间内
+ * @param entries 第一个表项的起始地址，每项 RIP_ENTRY_SIZE 字节，不要求对齐
+ * @param count 表项个数
+ * @param command RIP 的 Command ，1 或 2
+ * @return 全部合法则返回 true ，否则返回 false
+ *
+ * x86-64 上用 SSE2 每次检查 4 项， CPU 支持 AVX2 时每次检查 8 项；
+ * ripValidateEntriesScalar() 是逐项检查的参考实现，两者的结果总是相同。
+ */
+bool ripValidateEntries(const uint8_t *entries, uint32_t count, uint8_t command);
+bool ripValidateEntriesScalar(const uint8_t *entries, uint32_t count, uint8_t command);
+
+#endif
@@ -0,0 +1,119 @@
+#include "rip.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define RIP_VALIDATE_X86
+#endif
+
+// Every check works on 32-bit words of the entry, loaded in memory order (little endian
+// on x86): the first word holds family and tag, the mask and metric words are
+// byte-swapped to host order before the arithmetic.
+
+static inline uint32_t loadWord(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+bool ripValidateEntriesScalar(const uint8_t *entries, uint32_t count, uint8_t command) {
+  uint8_t family = command == 0x2 ? 0x2 : 0x0;
+  const uint8_t *entry = entries;
+  for (uint32_t i = 0; i < count; i++, entry += RIP_ENTRY_SIZE) {
+    if (entry[1] != family || entry[2] != 0x0 || entry[3] != 0x0) {
+      return false;
+    }
+    // the mask is some ones followed by zeros, so its complement plus one is a power of two
+    uint32_t mask = ((uint32_t)entry[8] << 24) | ((uint32_t)entry[9] << 16) | ((uint32_t)entry[10] << 8) | entry[11];
+    if ((~mask & (~mask + 1)) != 0) {
+      return false;
+    }
+    uint32_t metric = ((uint32_t)entry[16] << 24) | ((uint32_t)entry[17] << 16) | ((uint32_t)entry[18] << 8) | entry[19];
+    if (metric < 1 || metric > 16) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef RIP_VALIDATE_X86
+static inline __m128i byteSwap(__m128i v) {
+  v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+}
+
+// the same word of 4 consecutive entries, gathered in registers
+static inline __m128i loadColumn(const uint8_t *entry) {
+  __m128i a = _mm_cvtsi32_si128(loadWord(entry));
+  __m128i b = _mm_cvtsi32_si128(loadWord(entry + RIP_ENTRY_SIZE));
+  __m128i c = _mm_cvtsi32_si128(loadWord(entry + 2 * RIP_ENTRY_SIZE));
+  __m128i d = _mm_cvtsi32_si128(loadWord(entry + 3 * RIP_ENTRY_SIZE));
+  return _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+}
+
+// 4 entries at a time, SSE2 is always there on x86-64
+static bool validateSse2(const uint8_t *entries, uint32_t count, uint8_t command) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi32(-1);
+  const __m128i head_mask = _mm_set1_epi32(0xffffff00);
+  const __m128i head = _mm_set1_epi32((command == 0x2 ? 0x2 : 0x0) << 8);
+  const __m128i metric_high = _mm_set1_epi32(~15);
+  __m128i ok = ones;
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const uint8_t *entry = entries + i * RIP_ENTRY_SIZE;
+    __m128i family_tag = _mm_and_si128(loadColumn(entry), head_mask);
+    __m128i inverse = _mm_xor_si128(byteSwap(loadColumn(entry + 8)), ones);
+    __m128i contiguous = _mm_and_si128(inverse, _mm_sub_epi32(inverse, ones));
+    // metric - 1 in [0, 15] unsigned
+    __m128i metric = _mm_and_si128(_mm_add_epi32(byteSwap(loadColumn(entry + 16)), ones), metric_high);
+    ok = _mm_and_si128(ok, _mm_cmpeq_epi32(family_tag, head));
+    ok = _mm_and_si128(ok, _mm_cmpeq_epi32(contiguous, zero));
+    ok = _mm_and_si128(ok, _mm_cmpeq_epi32(metric, zero));
+  }
+  return _mm_movemask_epi8(ok) == 0xffff &&
+         ripValidateEntriesScalar(entries + i * RIP_ENTRY_SIZE, count - i, command);
+}
+
+__attribute__((target("avx2"))) static inline __m256i loadColumn8(const uint8_t *entry) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(loadColumn(entry)),
+                                 loadColumn(entry + 4 * RIP_ENTRY_SIZE), 1);
+}
+
+// 8 entries at a time
+__attribute__((target("avx2"))) static bool validateAvx2(const uint8_t *entries, uint32_t count,
+                                                         uint8_t command) {
+  const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi32(-1);
+  const __m256i head_mask = _mm256_set1_epi32(0xffffff00);
+  const __m256i head = _mm256_set1_epi32((command == 0x2 ? 0x2 : 0x0) << 8);
+  const __m256i metric_high = _mm256_set1_epi32(~15);
+  __m256i bad = zero;
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const uint8_t *entry = entries + i * RIP_ENTRY_SIZE;
+    __m256i family_tag = loadColumn8(entry);
+    __m256i mask = loadColumn8(entry + 8);
+    __m256i metric = loadColumn8(entry + 16);
+    __m256i inverse = _mm256_xor_si256(_mm256_shuffle_epi8(mask, swap), ones);
+    metric = _mm256_add_epi32(_mm256_shuffle_epi8(metric, swap), ones);
+    bad = _mm256_or_si256(bad, _mm256_xor_si256(_mm256_and_si256(family_tag, head_mask), head));
+    bad = _mm256_or_si256(bad, _mm256_and_si256(inverse, _mm256_sub_epi32(inverse, ones)));
+    bad = _mm256_or_si256(bad, _mm256_and_si256(metric, metric_high));
+  }
+  // the tail goes to the scalar loop, legacy SSE code right after AVX code would stall
+  return _mm256_testz_si256(bad, bad) &&
+         ripValidateEntriesScalar(entries + i * RIP_ENTRY_SIZE, count - i, command);
+}
+#endif
+
+bool ripValidateEntries(const uint8_t *entries, uint32_t count, uint8_t command) {
+#ifdef RIP_VALIDATE_X86
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2 ? validateAvx2(entries, count, command) : validateSse2(entries, count, command);
+#else
+  return ripValidateEntriesScalar(entries, count, command);
+#endif
+}
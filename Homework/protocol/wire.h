@@ -0,0 +1,132 @@
+#ifndef __WIRE_H__
+#define __WIRE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+  IPv4 、UDP 、ICMP 和 RIP 报文格式的编译期描述，只有头文件。
+  每个字段是一个类型，记录它相对于所在头部起始位置的偏移和宽度：
+  WireField<T, Offset> 的值在主机字节序下读写，load()/store() 是一次不对齐的宽访存（memcpy）
+  加上一条 bswap ，不再逐字节移位拼接；WireRaw<Offset> 是本来就按大端序保存的 32 位字段
+  （地址、mask 等），原样复制。WireSpan<First, Last> 是从 First 到 Last 的一段连续字段，
+  整段一次复制，编译成一两条向量 mov 。偏移和宽度都是常量表达式，可以在 static_assert 中检查布局。
+  写入一个头部的相邻常量字段时，编译器（-O2）会把它们合并成更宽的写入。
+*/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline uint8_t wireSwap(uint8_t value) { return value; }
+static inline uint16_t wireSwap(uint16_t value) { return value; }
+static inline uint32_t wireSwap(uint32_t value) { return value; }
+#else
+static inline uint8_t wireSwap(uint8_t value) { return value; }
+static inline uint16_t wireSwap(uint16_t value) { return __builtin_bswap16(value); }
+static inline uint32_t wireSwap(uint32_t value) { return __builtin_bswap32(value); }
+#endif
+
+template <typename T, size_t Offset>
+struct WireField {
+  typedef T Type;
+  static constexpr size_t offset = Offset;
+  static constexpr size_t size = sizeof(T);
+
+  static T load(const uint8_t *header) {
+    T value;
+    memcpy(&value, header + Offset, sizeof(T));
+    return wireSwap(value);
+  }
+
+  static void store(uint8_t *header, T value) {
+    value = wireSwap(value);
+    memcpy(header + Offset, &value, sizeof(T));
+  }
+};
+
+template <size_t Offset>
+struct WireRaw {
+  typedef uint32_t Type;
+  static constexpr size_t offset = Offset;
+  static constexpr size_t size = sizeof(uint32_t);
+
+  static uint32_t load(const uint8_t *header) {
+    uint32_t value;
+    memcpy(&value, header + Offset, sizeof(value));
+    return value;
+  }
+
+  static void store(uint8_t *header, uint32_t value) {
+    memcpy(header + Offset, &value, sizeof(value));
+  }
+};
+
+template <typename First, typename Last>
+struct WireSpan {
+  static_assert(First::offset <= Last::offset, "fields out of order");
+  static constexpr size_t offset = First::offset;
+  static constexpr size_t size = Last::offset + Last::size - First::offset;
+
+  static void load(const uint8_t *header, void *out) { memcpy(out, header + offset, size); }
+  static void store(uint8_t *header, const void *in) { memcpy(header + offset, in, size); }
+};
+
+// RFC 791 ，不含选项
+struct IPv4Wire {
+  static constexpr size_t size = 20;
+  typedef WireField<uint8_t, 0> VersionIhl;
+  typedef WireField<uint8_t, 1> Tos;
+  typedef WireField<uint16_t, 2> TotalLength;
+  typedef WireField<uint16_t, 4> Id;
+  typedef WireField<uint16_t, 6> FlagsFragment;
+  typedef WireField<uint8_t, 8> Ttl;
+  typedef WireField<uint8_t, 9> Protocol;
+  typedef WireField<uint16_t, 10> Checksum;
+  typedef WireRaw<12> Src;
+  typedef WireRaw<16> Dst;
+  // 分片偏移和 MF 位，不为零说明是一个分片
+  static constexpr uint16_t FRAGMENT_MASK = 0x3fff;
+};
+
+// RFC 768
+struct UdpWire {
+  static constexpr size_t size = 8;
+  typedef WireField<uint16_t, 0> SrcPort;
+  typedef WireField<uint16_t, 2> DstPort;
+  typedef WireField<uint16_t, 4> Length;
+  typedef WireField<uint16_t, 6> Checksum;
+};
+
+// RFC 792 ，差错报文的头部，后面是原来的 IP 头和载荷的开头
+struct IcmpWire {
+  static constexpr size_t size = 8;
+  static constexpr uint8_t PROTOCOL = 1;
+  static constexpr uint8_t DEST_UNREACHABLE = 3;
+  static constexpr uint8_t TIME_EXCEEDED = 11;
+  typedef WireField<uint8_t, 0> Type;
+  typedef WireField<uint8_t, 1> Code;
+  typedef WireField<uint16_t, 2> Checksum;
+  typedef WireField<uint32_t, 4> Unused;
+};
+
+// RFC 2453 4 ，RIP 头
+struct RipWire {
+  static constexpr size_t size = 4;
+  static constexpr uint16_t PORT = 520;
+  typedef WireField<uint8_t, 0> Command;
+  typedef WireField<uint8_t, 1> Version;
+  typedef WireField<uint16_t, 2> Zero;
+};
+
+// RFC 2453 4 ，一个 RIP 表项；Addr 到 Metric 在 RipEntry 中按同样的顺序保存为大端序
+struct RipEntryWire {
+  static constexpr size_t size = 20;
+  typedef WireField<uint16_t, 0> Family;
+  typedef WireField<uint16_t, 2> Tag;
+  typedef WireRaw<4> Addr;
+  typedef WireRaw<8> Mask;
+  typedef WireRaw<12> Nexthop;
+  typedef WireRaw<16> Metric;
+  typedef WireSpan<Addr, Metric> Route;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include "rip.h"
+#include "wire.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+using std::vector;
+
+// wire.h 的测试：随机生成 RipPacket ，检查 assemble() 与原来逐字节移位的写法结果完全相同，
+// 加上 IP 和 UDP 头之后 disassemble() 能原样读回；再检查各个字段的字节序和偏移。
+// 最后测量逐字节的写法和 wire.h 的写法每秒能序列化、解析的表项数。
+
+#define N_CASES 200000
+#define N_PACKETS 4096
+#define N_ROUNDS 200
+
+extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
+extern uint32_t assemble(const RipPacket *rip, uint8_t *buffer);
+
+static uint32_t rng = 2463534242u;
+static uint32_t xorshift() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void randomPacket(RipPacket *rip) {
+  rip->command = 1 + xorshift() % 2;
+  rip->numEntries = 1 + xorshift() % RIP_MAX_ENTRY;
+  for (uint32_t i = 0; i < rip->numEntries; i++) {
+    uint32_t len = xorshift() % 33;
+    uint32_t mask = len ? 0xffffffffu << (32 - len) : 0;
+    rip->entries[i].addr = htonl(xorshift() & mask);
+    rip->entries[i].mask = htonl(mask);
+    rip->entries[i].nexthop = xorshift();
+    rip->entries[i].metric = htonl(1 + xorshift() % 16);
+  }
+}
+
+// what assemble() used to do
+static uint32_t assembleBytewise(const RipPacket *rip, uint8_t *buffer) {
+  uint32_t count = rip->numEntries;
+  buffer[0] = rip->command;
+  buffer[1] = 0x2;
+  buffer[2] = 0x0;
+  buffer[3] = 0x0;
+  for(uint32_t i = 0; i < count; i++) {
+    buffer[4 + i*20] = 0x0;
+    buffer[4 + i*20 + 1] = (rip->command == 0x2) ? 0x2 : 0x0;
+    buffer[4 + i*20 + 2] = 0x0;
+    buffer[4 + i*20 + 3] = 0x0;
+    buffer[4 + i*20 + 4] = (uint8_t)(rip->entries[i].addr & 0xff);
+    buffer[4 + i*20 + 5] = (uint8_t)((rip->entries[i].addr >> 8) & 0xff);
+    buffer[4 + i*20 + 6] = (uint8_t)((rip->entries[i].addr >> 16) & 0xff);
+    buffer[4 + i*20 + 7] = (uint8_t)((rip->entries[i].addr >> 24) & 0xff);
+    buffer[4 + i*20 + 8] = (uint8_t)(rip->entries[i].mask & 0xff);
+    buffer[4 + i*20 + 9] = (uint8_t)((rip->entries[i].mask >> 8) & 0xff);
+    buffer[4 + i*20 + 10] = (uint8_t)((rip->entries[i].mask >> 16) & 0xff);
+    buffer[4 + i*20 + 11] = (uint8_t)((rip->entries[i].mask >> 24) & 0xff);
+    buffer[4 + i*20 + 12] = (uint8_t)(rip->entries[i].nexthop & 0xff);
+    buffer[4 + i*20 + 13] = (uint8_t)((rip->entries[i].nexthop >> 8) & 0xff);
+    buffer[4 + i*20 + 14] = (uint8_t)((rip->entries[i].nexthop >> 16) & 0xff);
+    buffer[4 + i*20 + 15] = (uint8_t)((rip->entries[i].nexthop >> 24) & 0xff);
+    buffer[4 + i*20 + 16] = (uint8_t)(rip->entries[i].metric & 0xff);
+    buffer[4 + i*20 + 17] = (uint8_t)((rip->entries[i].metric >> 8) & 0xff);
+    buffer[4 + i*20 + 18] = (uint8_t)((rip->entries[i].metric >> 16) & 0xff);
+    buffer[4 + i*20 + 19] = (uint8_t)((rip->entries[i].metric >> 24) & 0xff);
+  }
+  return 4 + 20 * count;
+}
+
+// the field by field copy disassemble() used to do once the entries are checked
+static void readBytewise(const uint8_t *rip, uint32_t count, RipPacket *output) {
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t *entry = rip + 4 + i * 20;
+    uint32_t *fields[4] = {&output->entries[i].addr, &output->entries[i].mask, &output->entries[i].nexthop,
+                           &output->entries[i].metric};
+    for (uint32_t j = 0; j < 4; j++) {
+      *fields[j] = entry[4 + 4 * j] + ((uint32_t)entry[5 + 4 * j] << 8) + ((uint32_t)entry[6 + 4 * j] << 16) +
+                   ((uint32_t)entry[7 + 4 * j] << 24);
+    }
+  }
+  output->numEntries = count;
+  output->command = rip[0];
+}
+
+static void readWire(const uint8_t *rip, uint32_t count, RipPacket *output) {
+  for (uint32_t i = 0; i < count; i++) {
+    output->entries[i] = RipEntryView(rip + RIP_HEADER_SIZE + i * RIP_ENTRY_SIZE).route();
+  }
+  output->numEntries = count;
+  output->command = RipWire::Command::load(rip);
+}
+
+static uint32_t wrap(uint8_t *packet, uint32_t rip_len) {
+  uint32_t total = IPv4Wire::size + UdpWire::size + rip_len;
+  memset(packet, 0, IPv4Wire::size + UdpWire::size);
+  IPv4Wire::VersionIhl::store(packet, 0x45);
+  IPv4Wire::TotalLength::store(packet, total);
+  IPv4Wire::Protocol::store(packet, 17);
+  UdpWire::Length::store(packet + IPv4Wire::size, UdpWire::size + rip_len);
+  return total;
+}
+
+static bool roundTrip() {
+  uint8_t expected[2048], packet[2048];
+  RipPacket rip, back;
+  uint32_t errors = 0;
+  for (uint32_t i = 0; i < N_CASES; i++) {
+    randomPacket(&rip);
+    uint32_t len = assembleBytewise(&rip, expected);
+    uint8_t *buffer = packet + IPv4Wire::size + UdpWire::size;
+    if (assemble(&rip, buffer) != len || memcmp(buffer, expected, len) != 0) {
+      if (errors++ < 10) {
+        printf("assemble differs: command %u, %u entries\n", rip.command, rip.numEntries);
+      }
+      continue;
+    }
+    uint32_t total = wrap(packet, len);
+    if (!disassemble(packet, total, &back) || back.command != rip.command || back.numEntries != rip.numEntries ||
+        memcmp(back.entries, rip.entries, rip.numEntries * sizeof(RipEntry)) != 0) {
+      if (errors++ < 10) {
+        printf("disassemble differs: command %u, %u entries\n", rip.command, rip.numEntries);
+      }
+    }
+  }
+  printf("round trip: %u cases, %u errors\n", N_CASES, errors);
+  return errors == 0;
+}
+
+static bool fields() {
+  uint8_t header[IPv4Wire::size];
+  memset(header, 0, sizeof(header));
+  IPv4Wire::TotalLength::store(header, 0x1234);
+  IPv4Wire::FlagsFragment::store(header, 0x4000);
+  IPv4Wire::Ttl::store(header, 64);
+  IPv4Wire::Checksum::store(header, 0xabcd);
+  IPv4Wire::Dst::store(header, htonl(0xe0000009));
+  const uint8_t expected[IPv4Wire::size] = {0, 0, 0x12, 0x34, 0, 0, 0x40, 0, 64, 0, 0xab, 0xcd, 0, 0, 0, 0,
+                                            0xe0, 0, 0, 0x09};
+  bool ok = memcmp(header, expected, sizeof(header)) == 0 && IPv4Wire::TotalLength::load(header) == 0x1234 &&
+            IPv4Wire::Checksum::load(header) == 0xabcd && IPv4Wire::Dst::load(header) == htonl(0xe0000009);
+  printf("fields: %s\n", ok ? "ok" : "wrong layout");
+  return ok;
+}
+
+template <typename F>
+static double entriesPerSecond(F run) {
+  auto begin = std::chrono::steady_clock::now();
+  uint64_t sink = 0;
+  for (uint32_t round = 0; round < N_ROUNDS; round++) {
+    for (uint32_t i = 0; i < N_PACKETS; i++) {
+      sink += run(i);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (sink == 0) {
+    printf("nothing written\n");
+  }
+  return (double)N_ROUNDS * N_PACKETS * RIP_MAX_ENTRY / std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char *argv[]) {
+  bool ok = fields();
+  ok = roundTrip() && ok;
+
+  // full responses
+  vector<RipPacket> packets(N_PACKETS);
+  for (uint32_t i = 0; i < N_PACKETS; i++) {
+    randomPacket(&packets[i]);
+    packets[i].command = 0x2;
+    packets[i].numEntries = RIP_MAX_ENTRY;
+  }
+  const uint32_t size = RIP_HEADER_SIZE + RIP_MAX_ENTRY * RIP_ENTRY_SIZE;
+  vector<uint8_t> buffers(N_PACKETS * size);
+  RipPacket out;
+  double write_bytes = entriesPerSecond([&](uint32_t i) { return assembleBytewise(&packets[i], &buffers[i * size]); });
+  double write_wire = entriesPerSecond([&](uint32_t i) { return assemble(&packets[i], &buffers[i * size]); });
+  double read_bytes = entriesPerSecond([&](uint32_t i) {
+    readBytewise(&buffers[i * size], RIP_MAX_ENTRY, &out);
+    return out.entries[i % RIP_MAX_ENTRY].addr | 1;
+  });
+  double read_wire = entriesPerSecond([&](uint32_t i) {
+    readWire(&buffers[i * size], RIP_MAX_ENTRY, &out);
+    return out.entries[i % RIP_MAX_ENTRY].addr | 1;
+  });
+  printf("assemble, byte by byte %8.1f M entries/s\n", write_bytes / 1e6);
+  printf("assemble, wire.h       %8.1f M entries/s (%.2fx)\n", write_wire / 1e6, write_wire / write_bytes);
+  printf("read,     byte by byte %8.1f M entries/s\n", read_bytes / 1e6);
+  printf("read,     wire.h       %8.1f M entries/s (%.2fx)\n", read_wire / 1e6, read_wire / read_bytes);
+  printf(ok ? "OK\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}